@@ -0,0 +1,510 @@
+#include "batch_reader.h"
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+#ifdef __linux__
+// The few io_uring operations the reader needs, over the raw system calls.
+// Only one thread drives a ring, so the local tail and the completion head
+// need no synchronization beyond the acquire/release pairs with the kernel.
+class Ring {
+public:
+    Ring() : fd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqeArea(MAP_FAILED),
+             sqRingSize(0), cqRingSize(0), sqeAreaSize(0), localTail(0), queued(0) {}
+
+    ~Ring() {
+        if (sqeArea != MAP_FAILED) munmap(sqeArea, sqeAreaSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        if (fd >= 0) close(fd);
+    }
+
+    bool setup(unsigned entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (fd < 0) return false;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) sqRingSize = cqRingSize = max(sqRingSize, cqRingSize);
+
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      fd, IORING_OFF_SQ_RING);
+        if (sqRing == MAP_FAILED) return false;
+        cqRing = singleMap ? sqRing
+                           : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED) return false;
+        sqeAreaSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqeArea = mmap(nullptr, sqeAreaSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       fd, IORING_OFF_SQES);
+        if (sqeArea == MAP_FAILED) return false;
+
+        char *sq = static_cast<char *>(sqRing);
+        char *cq = static_cast<char *>(cqRing);
+        sqHead = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+        sqTail = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+        sqEntries = params.sq_entries;
+        sqArray = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+        sqes = static_cast<io_uring_sqe *>(sqeArea);
+        cqHead = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+        localTail = *sqTail;
+        return true;
+    }
+
+    bool supports(unsigned opcode) const {
+        const unsigned opCount = 256;
+        vector<char> storage(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op), 0);
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, opCount) < 0) return false;
+        return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) != 0;
+    }
+
+    bool registerBuffers(const iovec *buffers, unsigned count) {
+        return syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, buffers, count) == 0;
+    }
+
+    bool unregisterBuffers() {
+        return syscall(__NR_io_uring_register, fd, IORING_UNREGISTER_BUFFERS, nullptr, 0) == 0;
+    }
+
+    // A zeroed submission entry. A full queue is submitted to make room;
+    // null if that fails.
+    io_uring_sqe *nextSqe() {
+        unsigned head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+        if (localTail - head >= sqEntries) {
+            if (!enter(0)) return nullptr;
+            head = __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+            if (localTail - head >= sqEntries) return nullptr;
+        }
+        unsigned index = localTail & sqMask;
+        io_uring_sqe *sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqArray[index] = index;
+        localTail++;
+        queued++;
+        return sqe;
+    }
+
+    // Submits queued entries and waits for at least waitFor completions
+    bool enter(unsigned waitFor) {
+        if (queued == 0 && waitFor == 0) return true;
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        long submitted;
+        do {
+            submitted = syscall(__NR_io_uring_enter, fd, queued, waitFor,
+                                waitFor ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        } while (submitted < 0 && errno == EINTR);
+        if (submitted < 0) return false;
+        queued -= static_cast<unsigned>(submitted);
+        return true;
+    }
+
+    bool popCompletion(uint64_t &userData, int &result) {
+        unsigned head = *cqHead;
+        if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) return false;
+        const io_uring_cqe &cqe = cqes[head & cqMask];
+        userData = cqe.user_data;
+        result = cqe.res;
+        __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+        return true;
+    }
+
+private:
+    int fd;
+    void *sqRing;
+    void *cqRing;
+    void *sqeArea;
+    size_t sqRingSize;
+    size_t cqRingSize;
+    size_t sqeAreaSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned *sqArray;
+    io_uring_sqe *sqes;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned cqMask;
+    io_uring_cqe *cqes;
+    unsigned localTail;  // Tail including entries not yet published
+    unsigned queued;     // Entries not yet submitted
+};
+#endif
+
+#ifndef _WIN32
+// Size of an open regular file, or 0 if it has none (pipes, /proc entries)
+uint64_t fileSize(int fd) {
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) return 0;
+    return static_cast<uint64_t>(info.st_size);
+}
+#endif
+
+// Returns 0, or the errno of the call that failed so both backends report
+// the same message for the same file
+int readFileInto(const string &path, string &contents) {
+#ifndef _WIN32
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return errno;
+    uint64_t size = fileSize(fd);
+    if (size > 0) contents.resize(static_cast<size_t>(size));
+    size_t length = 0;
+    int error = 0;
+    while (size == 0 || length < size) {
+        if (length == contents.size()) contents.resize(max<size_t>(2 * length, 4096));
+        ssize_t result = ::read(fd, &contents[length], contents.size() - length);
+        if (result < 0 && errno == EINTR) continue;
+        if (result < 0) error = errno;
+        if (result <= 0) break;
+        length += static_cast<size_t>(result);
+    }
+    close(fd);
+    contents.resize(length);
+    return error;
+#else
+    ifstream in(path, ios::binary);
+    if (!in) return errno ? errno : EIO;
+    contents.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+    return in.bad() ? EIO : 0;
+#endif
+}
+
+} // namespace
+
+bool BatchReader::setError(const string &message) {
+    errorOccurred = true;
+    errorMessage = message;
+    return false;
+}
+
+bool BatchReader::read(const vector<string> &paths, const FileHandler &onFile,
+                       const ErrorHandler &onError) {
+    errorOccurred = false;
+    errorMessage.clear();
+    if (queueDepth == 0 || bufferSize == 0) return setError("Queue depth and buffer size must be positive");
+    // io_uring addresses registered buffers with a 16-bit index
+    if (queueDepth > 65535) return setError("Queue depth must not exceed 65535");
+
+    bool unavailable = true;
+#ifdef __linux__
+    if (readWithRing(paths, onFile, onError, unavailable)) return true;
+#endif
+    if (!unavailable) return false;
+    return readWithThreads(paths, onFile, onError);
+}
+
+#ifdef __linux__
+bool BatchReader::readWithRing(const vector<string> &paths, const FileHandler &onFile,
+                               const ErrorHandler &onError, bool &unavailable) {
+    unavailable = true;
+    Ring ring;
+    if (!ring.setup(queueDepth) || !ring.supports(IORING_OP_OPENAT) ||
+        !ring.supports(IORING_OP_CLOSE)) {
+        return false;
+    }
+
+    // One registered buffer per slot; each slot carries one file through
+    // open, read and close with at most one request in flight
+    vector<char> storage(static_cast<size_t>(queueDepth) * bufferSize);
+    vector<iovec> buffers(queueDepth);
+    for (unsigned i = 0; i < queueDepth; i++) {
+        buffers[i].iov_base = storage.data() + i * bufferSize;
+        buffers[i].iov_len = bufferSize;
+    }
+    if (!ring.registerBuffers(buffers.data(), queueDepth)) return false;
+    unavailable = false;
+    backend = "io_uring";
+
+    enum class Stage { OPENING, READING, CLOSING };
+    struct Slot {
+        size_t path;
+        int fd;
+        uint64_t offset;
+        uint64_t size;    // Size when opened, or 0 if unknown
+        size_t filled;  // Bytes of the current chunk in the slot's buffer
+        string spill;   // Earlier chunks of a file larger than the buffer
+        Stage stage;
+    };
+    vector<Slot> slots(queueDepth);
+    size_t nextPath = 0;
+    unsigned active = 0;
+
+    // Each returns false if no submission entry can be had
+    auto startOpen = [&](unsigned s) {
+        if (nextPath >= paths.size()) return true;
+        Slot &slot = slots[s];
+        slot.path = nextPath++;
+        slot.fd = -1;
+        slot.offset = 0;
+        slot.size = 0;
+        slot.filled = 0;
+        slot.spill.clear();
+        slot.stage = Stage::OPENING;
+        io_uring_sqe *sqe = ring.nextSqe();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_OPENAT;
+        sqe->fd = AT_FDCWD;
+        sqe->addr = reinterpret_cast<uint64_t>(paths[slot.path].c_str());
+        sqe->open_flags = O_RDONLY | O_CLOEXEC;
+        sqe->user_data = s;
+        active++;
+        return true;
+    };
+    auto queueRead = [&](unsigned s) {
+        Slot &slot = slots[s];
+        slot.stage = Stage::READING;
+        io_uring_sqe *sqe = ring.nextSqe();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = slot.fd;
+        sqe->addr = reinterpret_cast<uint64_t>(static_cast<char *>(buffers[s].iov_base) + slot.filled);
+        sqe->len = static_cast<uint32_t>(bufferSize - slot.filled);
+        sqe->off = slot.offset;
+        sqe->buf_index = static_cast<uint16_t>(s);  // read() caps queueDepth
+        sqe->user_data = s;
+        return true;
+    };
+    auto queueClose = [&](unsigned s) {
+        Slot &slot = slots[s];
+        slot.stage = Stage::CLOSING;
+        io_uring_sqe *sqe = ring.nextSqe();
+        if (!sqe) return false;
+        sqe->opcode = IORING_OP_CLOSE;
+        sqe->fd = slot.fd;
+        sqe->user_data = s;
+        return true;
+    };
+    // Closes a slot's file directly when no request can be queued for it
+    auto abandon = [&](unsigned s) {
+        Slot &slot = slots[s];
+        if (slot.fd >= 0) close(slot.fd);
+        slot.fd = -1;
+        active--;
+    };
+    const string queueFailed = "Cannot queue io_uring request";
+    string failure;  // Once set, no new requests are started
+
+    for (unsigned s = 0; s < queueDepth && failure.empty(); s++) {
+        if (!startOpen(s)) failure = queueFailed;
+    }
+
+    struct Finished {
+        size_t path;    // Kept here: a failed open frees its slot at once
+        unsigned slot;
+        size_t length;  // Bytes in the slot's buffer
+        int error;      // errno, or 0
+    };
+    vector<Finished> finished;
+    string contents;  // Reused to hand buffered files over
+    uint64_t userData;
+    int result;
+
+    while (active > 0 && failure.empty()) {
+        if (!ring.enter(1)) {
+            failure = string("io_uring_enter failed: ") + strerror(errno);
+            break;
+        }
+
+        finished.clear();
+        while (failure.empty() && ring.popCompletion(userData, result)) {
+            unsigned s = static_cast<unsigned>(userData);
+            Slot &slot = slots[s];
+            bool queued = true;
+            switch (slot.stage) {
+                case Stage::OPENING:
+                    if (result < 0) {
+                        finished.push_back({slot.path, s, 0, -result});
+                        active--;
+                        queued = startOpen(s);
+                    } else {
+                        slot.fd = result;
+                        slot.size = fileSize(result);
+                        queued = queueRead(s);
+                    }
+                    break;
+                case Stage::READING:
+                    // A file is complete once its size has been read, or
+                    // at an empty read if it shrank or its size is unknown.
+                    // Reads may come back short before that.
+                    if (result < 0) {
+                        finished.push_back({slot.path, s, 0, -result});
+                        queued = queueClose(s);
+                    } else {
+                        slot.filled += static_cast<size_t>(result);
+                        slot.offset += static_cast<uint64_t>(result);
+                        if (slot.filled == bufferSize) {
+                            slot.spill.append(static_cast<const char *>(buffers[s].iov_base), bufferSize);
+                            slot.filled = 0;
+                        }
+                        if (result == 0 || (slot.size > 0 && slot.offset >= slot.size)) {
+                            finished.push_back({slot.path, s, slot.filled, 0});
+                            queued = queueClose(s);
+                        } else {
+                            queued = queueRead(s);
+                        }
+                    }
+                    break;
+                case Stage::CLOSING:
+                    slot.fd = -1;
+                    active--;
+                    queued = startOpen(s);
+                    break;
+            }
+            if (!queued) {
+                failure = queueFailed;
+                // A slot that failed to start a new file holds nothing
+                if (slot.stage != Stage::OPENING) abandon(s);
+            }
+        }
+        if (!failure.empty()) break;
+
+        // Start the next requests before handing files over, so the kernel
+        // reads ahead while the caller works. A finished slot's buffer is
+        // not reused until its close completes in a later round.
+        if (!ring.enter(0)) {
+            failure = string("io_uring_enter failed: ") + strerror(errno);
+            break;
+        }
+        for (const Finished &file : finished) {
+            Slot &slot = slots[file.slot];
+            const string &path = paths[file.path];
+            if (file.error) {
+                onError(path, strerror(file.error));
+            } else if (slot.spill.empty()) {
+                contents.assign(static_cast<const char *>(buffers[file.slot].iov_base), file.length);
+                onFile(path, contents);
+            } else {
+                slot.spill.append(static_cast<const char *>(buffers[file.slot].iov_base), file.length);
+                onFile(path, slot.spill);
+            }
+        }
+    }
+
+    // After a failure the requests still in flight may write into storage
+    // and hold files open, so wait for each of them and close its file
+    bool drained = true;
+    while (active > 0) {
+        if (!ring.enter(1)) {
+            drained = false;
+            break;
+        }
+        while (ring.popCompletion(userData, result)) {
+            Slot &slot = slots[static_cast<unsigned>(userData)];
+            if (slot.stage == Stage::OPENING && result >= 0) slot.fd = result;
+            if (slot.stage != Stage::CLOSING && slot.fd >= 0) close(slot.fd);
+            slot.fd = -1;
+            active--;
+        }
+    }
+    if (!drained) {
+        // The kernel may still write into the buffers, so they are left
+        // allocated rather than freed under it
+        for (Slot &slot : slots) {
+            if (slot.stage != Stage::CLOSING && slot.fd >= 0) close(slot.fd);
+        }
+        new vector<char>(move(storage));
+        return setError(failure);
+    }
+    ring.unregisterBuffers();
+    if (!failure.empty()) return setError(failure);
+    return true;
+}
+#endif
+
+bool BatchReader::readWithThreads(const vector<string> &paths, const FileHandler &onFile,
+                                  const ErrorHandler &onError) {
+    backend = "threads";
+    if (paths.empty()) return true;
+
+    // Blocking reads need more threads than cores to keep the queue full
+    unsigned hardware = max(1u, thread::hardware_concurrency());
+    unsigned workerCount = min(queueDepth, max(4u, 2 * hardware));
+    workerCount = static_cast<unsigned>(min<size_t>(workerCount, paths.size()));
+
+    struct Finished {
+        size_t path;
+        unsigned buffer;
+        int error;  // errno, or 0
+    };
+    vector<string> buffers(queueDepth);
+    vector<unsigned> freeBuffers;
+    for (unsigned i = 0; i < queueDepth; i++) freeBuffers.push_back(i);
+    deque<Finished> finished;
+    size_t nextPath = 0;
+    mutex lock;
+    condition_variable changed;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t path;
+            unsigned buffer;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&] { return !freeBuffers.empty() || nextPath >= paths.size(); });
+                if (nextPath >= paths.size()) return;
+                path = nextPath++;
+                buffer = freeBuffers.back();
+                freeBuffers.pop_back();
+            }
+            int error = readFileInto(paths[path], buffers[buffer]);
+            {
+                lock_guard<mutex> guard(lock);
+                finished.push_back({path, buffer, error});
+            }
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> workers;
+    for (unsigned i = 0; i < workerCount; i++) workers.emplace_back(worker);
+
+    for (size_t handled = 0; handled < paths.size(); handled++) {
+        Finished file;
+        {
+            unique_lock<mutex> guard(lock);
+            changed.wait(guard, [&] { return !finished.empty(); });
+            file = finished.front();
+            finished.pop_front();
+        }
+        if (file.error) onError(paths[file.path], strerror(file.error));
+        else onFile(paths[file.path], buffers[file.buffer]);
+        {
+            lock_guard<mutex> guard(lock);
+            freeBuffers.push_back(file.buffer);
+        }
+        changed.notify_all();
+    }
+
+    for (thread &t : workers) t.join();
+    return true;
+}
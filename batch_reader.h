@@ -0,0 +1,53 @@
+#ifndef BATCH_READER_H
+#define BATCH_READER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+using namespace std;
+
+// Reads a batch of files with many reads in flight and hands each file to
+// the caller as soon as it is complete, so processing one file overlaps the
+// I/O of the next ones.
+//
+// On Linux the reads go through io_uring: opens, reads into a pool of
+// registered buffers and closes are all queued asynchronously, and a buffer
+// is recycled once its file has been handed over. Elsewhere, or when the
+// kernel refuses a ring, a pool of reader threads fills the same number of
+// recycled buffers. Either way the callbacks run on the calling thread, in
+// completion order.
+class BatchReader {
+public:
+    typedef function<void(const string &path, const string &contents)> FileHandler;
+    typedef function<void(const string &path, const string &message)> ErrorHandler;
+
+    // queueDepth files (at most 65535) are in flight at once; files larger
+    // than bufferSize are read in several chunks
+    BatchReader(unsigned queueDepth = 32, size_t bufferSize = 128 * 1024)
+        : queueDepth(queueDepth), bufferSize(bufferSize), backend("none"), errorOccurred(false) {}
+
+    bool read(const vector<string> &paths, const FileHandler &onFile, const ErrorHandler &onError);
+
+    // "io_uring" or "threads", once read() has run
+    const string &getBackend() const { return backend; }
+    bool hasError() const { return errorOccurred; }
+    const string &getErrorMessage() const { return errorMessage; }
+
+private:
+    unsigned queueDepth;
+    size_t bufferSize;
+    string backend;
+    bool errorOccurred;
+    string errorMessage;
+
+    bool setError(const string &message);
+    // Sets unavailable and returns false, before touching any file, when
+    // no ring can be set up
+    bool readWithRing(const vector<string> &paths, const FileHandler &onFile,
+                      const ErrorHandler &onError, bool &unavailable);
+    bool readWithThreads(const vector<string> &paths, const FileHandler &onFile,
+                         const ErrorHandler &onError);
+};
+
+#endif // BATCH_READER_H
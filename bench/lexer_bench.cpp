@@ -0,0 +1,109 @@
+// Compares per-call token delivery (Lexer::getNextToken) with batched
+// delivery through TokenBuffer.
+//
+//   lexer_bench [file.py] [repetitions]
+//
+// Without a file, a synthetic module is generated.
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "../lexer.h"
+#include "../token_buffer.h"
+
+using namespace std;
+
+static string syntheticSource(int functions)
+{
+    ostringstream out;
+    for (int i = 0; i < functions; i++)
+    {
+        out << "def function_" << i << "(alpha, beta, gamma):\n"
+            << "    # Accumulate a value\n"
+            << "    total = alpha + beta * " << i << "\n"
+            << "    if total >= gamma:\n"
+            << "        total = total - gamma / 2.5\n"
+            << "    while total != 0:\n"
+            << "        total = helper(total, [1, 2, 3], \"text\")\n"
+            << "    return total\n\n";
+    }
+    return out.str();
+}
+
+// Sums token types so neither loop can be optimized away
+static size_t perCall(const string &source, size_t &checksum)
+{
+    Lexer lexer(source);
+    size_t count = 0;
+    while (true)
+    {
+        Token token = lexer.getNextToken();
+        checksum += static_cast<size_t>(token.type) + token.value.size();
+        count++;
+        if (token.type == TokenType::END_OF_FILE)
+            break;
+    }
+    return count;
+}
+
+static size_t batched(const string &source, size_t &checksum)
+{
+    Lexer lexer(source);
+    TokenBuffer tokens(lexer);
+    size_t count = 0;
+    while (true)
+    {
+        const Token &token = tokens.peek();
+        checksum += static_cast<size_t>(token.type) + token.value.size();
+        count++;
+        if (token.type == TokenType::END_OF_FILE)
+            break;
+        tokens.advance();
+    }
+    return count;
+}
+
+template <typename Run>
+static void measure(const char *label, const string &source, int repetitions, Run run)
+{
+    size_t checksum = 0;
+    size_t tokens = 0;
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; i++)
+    {
+        tokens = run(source, checksum);
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+    double perSecond = tokens * double(repetitions) / elapsed.count();
+    cout << label << ": " << tokens << " tokens x " << repetitions << " in "
+         << elapsed.count() * 1000.0 << " ms (" << perSecond / 1e6 << " M tokens/s, checksum "
+         << checksum << ")" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    string source;
+    if (argc > 1)
+    {
+        ifstream in(argv[1], ios::binary);
+        if (!in)
+        {
+            cerr << "Cannot open " << argv[1] << endl;
+            return 1;
+        }
+        ostringstream content;
+        content << in.rdbuf();
+        source = content.str();
+    }
+    else
+    {
+        source = syntheticSource(2000);
+    }
+    int repetitions = argc > 2 ? stoi(argv[2]) : 20;
+
+    measure("per-call", source, repetitions, perCall);
+    measure("batched ", source, repetitions, batched);
+    return 0;
+}
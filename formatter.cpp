@@ -0,0 +1,521 @@
+#include "formatter.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const int INDENT_WIDTH = 4;
+
+// Identifiers the lexer does not report as keywords but which never name
+// something that is called or subscripted
+const char* const SOFT_KEYWORDS[] = {
+    "and", "or", "not", "is", "lambda", "yield", "await", "assert", "del", "raise",
+    "import", "from", "as", "with", "except", "global", "nonlocal", "async", "class",
+    "try", "finally"
+};
+
+// Operators the lexer returns as several adjacent tokens
+const char* const COMPOUND_OPERATORS[] = {
+    "**", "//", "->", ":=", "<<", ">>", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=",
+    "@=", "**=", "//=", "<<=", ">>="
+};
+
+bool isSoftKeyword(const string& word) {
+    for (const char* keyword : SOFT_KEYWORDS) {
+        if (word == keyword) return true;
+    }
+    return false;
+}
+
+bool isCompound(const char* text, size_t length) {
+    for (const char* op : COMPOUND_OPERATORS) {
+        if (strlen(op) == length && memcmp(op, text, length) == 0) return true;
+    }
+    return false;
+}
+
+bool readFile(const string& path, string& content) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    in.seekg(0, ios::end);
+    content.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0, ios::beg);
+    in.read(&content[0], content.size());
+    return static_cast<bool>(in);
+}
+
+// Replaces the contents of path through a temporary file renamed over it,
+// so an interrupted run never leaves a half-written source file.
+// A symlink is resolved so its target is rewritten and the link kept, and
+// the original's mode and (where permitted) ownership carry over.
+bool replaceFile(const string& path, const string& contents, string& message) {
+#ifndef _WIN32
+    char resolved[PATH_MAX];
+    if (!realpath(path.c_str(), resolved)) {
+        message = "Cannot resolve path";
+        return false;
+    }
+    string target = resolved;
+    struct stat original;
+    if (stat(target.c_str(), &original) != 0) {
+        message = "Cannot stat file";
+        return false;
+    }
+
+    string tempPath = target + ".fmt.tmp";
+    int fd = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        message = "Cannot write " + tempPath;
+        return false;
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t n = write(fd, contents.data() + written, contents.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        written += static_cast<size_t>(n);
+    }
+    // Ownership can only be kept by a privileged user; failing that is fine
+    if (fchown(fd, original.st_uid, original.st_gid) != 0) {}
+    bool ok = written == contents.size() && fchmod(fd, original.st_mode & 07777) == 0;
+    if (close(fd) != 0) ok = false;
+    if (!ok) {
+        unlink(tempPath.c_str());
+        message = "Cannot write " + tempPath;
+        return false;
+    }
+#else
+    string target = path;
+    string tempPath = target + ".fmt.tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        out.write(contents.data(), contents.size());
+        if (!out) {
+            message = "Cannot write " + tempPath;
+            return false;
+        }
+    }
+    remove(target.c_str());
+#endif
+    if (rename(tempPath.c_str(), target.c_str()) != 0) {
+        message = "Cannot replace file";
+        return false;
+    }
+    return true;
+}
+
+void formatFile(const string& path, bool checkOnly, FormatResult& result) {
+    result.path = path;
+    result.changed = false;
+    result.failed = false;
+
+    string source;
+    if (!readFile(path, source)) {
+        result.failed = true;
+        result.message = "Cannot read file";
+        return;
+    }
+
+    Formatter formatter(source);
+    if (!formatter.format()) {
+        result.failed = true;
+        result.message = formatter.getErrorMessage();
+        return;
+    }
+    result.changed = formatter.getOutput() != source;
+    if (!result.changed || checkOnly) return;
+
+    if (!replaceFile(path, formatter.getOutput(), result.message)) result.failed = true;
+}
+
+} // namespace
+
+Formatter::Formatter(const string& source)
+    : source(source), lexer(source), openerPending(false), afterDecorator(false),
+      errorOccurred(false), errorOffset(0) {
+    lexer.setKeepComments(true);
+}
+
+bool Formatter::setError(const string& message, size_t offset) {
+    const LineIndex& lines = lexer.getLineIndex();
+    errorOccurred = true;
+    errorMessage = "Line " + to_string(lines.lineOf(offset)) + ", Column " +
+                   to_string(lines.columnOf(offset)) + ": " + message;
+    errorOffset = offset;
+    output.clear();
+    return false;
+}
+
+size_t Formatter::readLine() {
+    // Tokens are lexed straight into the reused slots, so steady state
+    // allocates nothing
+    size_t count = 0;
+    while (true) {
+        if (count == lineTokens.size()) {
+            lineTokens.emplace_back(TokenType::END_OF_FILE, "", 0, 0);
+        }
+        Token& token = lineTokens[count++];
+        lexer.nextToken(token);
+        if (token.type == TokenType::NEWLINE || token.type == TokenType::END_OF_FILE) {
+            return count;
+        }
+    }
+}
+
+bool Formatter::format() {
+    output.clear();
+    output.reserve(source.size() + source.size() / 8 + 16);
+    pending.clear();
+    blockWidths.assign(1, 0);
+    lastWasDef.assign(1, false);
+    openerPending = false;
+    afterDecorator = false;
+
+    while (true) {
+        size_t count = readLine();
+        bool atEnd = lineTokens[count - 1].type == TokenType::END_OF_FILE;
+
+        // INDENT/DEDENT lead the line; DEDENTs after the content only
+        // close blocks at the end of input
+        size_t begin = 0;
+        bool indented = false;
+        int dedents = 0;
+        for (; begin < count; begin++) {
+            if (lineTokens[begin].type == TokenType::INDENT) indented = true;
+            else if (lineTokens[begin].type == TokenType::DEDENT) dedents++;
+            else break;
+        }
+        size_t end = begin;
+        while (end < count && lineTokens[end].type != TokenType::NEWLINE &&
+               lineTokens[end].type != TokenType::END_OF_FILE &&
+               lineTokens[end].type != TokenType::DEDENT) {
+            end++;
+        }
+
+        if (begin == end) {
+            if (!atEnd) {
+                if (!pending.empty() && !pending.back().comment) pending.back().blanks++;
+                else pending.push_back({false, 0, 0, 0, 1});
+            }
+        } else {
+            if (!buildPieces(begin, end)) return false;
+
+            if (pieces.size() == 1 && pieces[0].kind == PieceKind::COMMENT) {
+                addPendingComment(pieces[0]);
+            } else {
+                int width = widthBefore(pieces[0].offset);
+                if (indented) {
+                    blockWidths.push_back(width);
+                    lastWasDef.push_back(false);
+                }
+                for (int i = 0; i < dedents && blockWidths.size() > 1; i++) {
+                    blockWidths.pop_back();
+                    lastWasDef.pop_back();
+                }
+                if (blockWidths.back() != width) {
+                    return setError("Unindent does not match any outer indentation level", pieces[0].offset);
+                }
+                int depth = static_cast<int>(blockWidths.size()) - 1;
+
+                const Piece& first = pieces[0];
+                bool isDef = pieceIs(first, "def") || pieceIs(first, "class") ||
+                             (pieceIs(first, "async") && pieces.size() > 1 && pieceIs(pieces[1], "def"));
+                bool isDecorator = first.unary && pieceIs(first, "@");
+
+                // Blank lines the statement needs before it; -1 keeps the
+                // original count (capped)
+                int required = -1;
+                if (afterDecorator) required = 0;
+                else if (isDef || isDecorator || lastWasDef[depth]) required = depth == 0 ? 2 : 1;
+
+                flushPending(depth, required, indented, false);
+                emitStatement(depth, width);
+
+                size_t last = pieces.size() - 1;
+                if (pieces[last].kind == PieceKind::COMMENT && last > 0) last--;
+                lastWasDef[depth] = isDef;
+                afterDecorator = isDecorator;
+                openerPending = pieces[last].kind == PieceKind::COLON;
+            }
+        }
+
+        if (atEnd) break;
+    }
+
+    flushPending(0, -1, false, true);
+    return true;
+}
+
+bool Formatter::buildPieces(size_t begin, size_t end) {
+    pieces.clear();
+    brackets.assign(1, {0, false, false});
+
+    for (size_t i = begin; i < end; i++) {
+        const Token& token = lineTokens[i];
+        Piece piece = {PieceKind::WORD, token.offset, token.length, false, false};
+
+        switch (token.type) {
+            case TokenType::DEF: case TokenType::IF: case TokenType::ELIF: case TokenType::ELSE:
+            case TokenType::WHILE: case TokenType::FOR: case TokenType::IN: case TokenType::RETURN:
+            case TokenType::PASS: case TokenType::BREAK: case TokenType::CONTINUE:
+                piece.kind = PieceKind::KEYWORD;
+                break;
+            case TokenType::PLUS: case TokenType::MINUS: case TokenType::MULTIPLY:
+            case TokenType::DIVIDE: case TokenType::ASSIGN: case TokenType::EQUALS:
+            case TokenType::NOT_EQUALS: case TokenType::LESS_THAN: case TokenType::GREATER_THAN:
+            case TokenType::LESS_EQUAL: case TokenType::GREATER_EQUAL:
+                piece.kind = PieceKind::OPERATOR;
+                break;
+            case TokenType::LPAREN: case TokenType::LBRACKET: case TokenType::LBRACE:
+                piece.kind = PieceKind::OPEN;
+                break;
+            case TokenType::RPAREN: case TokenType::RBRACKET: case TokenType::RBRACE:
+                piece.kind = PieceKind::CLOSE;
+                break;
+            case TokenType::COLON: piece.kind = PieceKind::COLON; break;
+            case TokenType::COMMA: piece.kind = PieceKind::COMMA; break;
+            case TokenType::DOT: piece.kind = PieceKind::DOT; break;
+            case TokenType::COMMENT:
+                piece.kind = PieceKind::COMMENT;
+                piece.length = trimmedEnd(token.offset, token.offset + token.length) - token.offset;
+                break;
+            case TokenType::IDENTIFIER:
+                if (isSoftKeyword(token.value)) piece.kind = PieceKind::KEYWORD;
+                break;
+            case TokenType::ERROR: {
+                // Characters outside the lexer's subset are copied through;
+                // an unterminated string would make the rest unreliable
+                char c = source[token.offset];
+                if (c == '"' || c == '\'') return setError("Unterminated string literal", token.offset);
+                if (token.length == 1) {
+                    if (c == ';') piece.kind = PieceKind::SEMICOLON;
+                    else if (strchr("%&|^@~", c)) piece.kind = PieceKind::OPERATOR;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        if (piece.kind == PieceKind::OPERATOR || piece.kind == PieceKind::COLON) {
+            while (i + 1 < end && lineTokens[i + 1].offset == piece.offset + piece.length &&
+                   isCompound(source.data() + piece.offset, piece.length + lineTokens[i + 1].length)) {
+                piece.length += lineTokens[++i].length;
+                piece.kind = PieceKind::OPERATOR;
+            }
+        }
+
+        PieceKind prev = pieces.empty() ? PieceKind::OPEN : pieces.back().kind;
+        switch (piece.kind) {
+            case PieceKind::OPEN:
+                brackets.push_back({source[piece.offset], false, false});
+                break;
+            case PieceKind::CLOSE:
+                if (brackets.size() > 1) brackets.pop_back();
+                break;
+            case PieceKind::COMMA:
+                brackets.back().annotated = false;
+                break;
+            case PieceKind::KEYWORD:
+                if (pieceIs(piece, "lambda")) brackets.back().lambdaArgs = true;
+                break;
+            case PieceKind::COLON:
+                if (brackets.back().lambdaArgs) brackets.back().lambdaArgs = false;
+                else if (brackets.back().open == '[') piece.tight = true;
+                else brackets.back().annotated = true;
+                break;
+            case PieceKind::OPERATOR:
+                if (pieceIs(piece, "=")) {
+                    piece.tight = brackets.back().lambdaArgs ||
+                                  (brackets.back().open == '(' && !brackets.back().annotated);
+                } else if (pieceIs(piece, "~")) {
+                    piece.unary = true;
+                } else if (pieceIs(piece, "-") || pieceIs(piece, "+") || pieceIs(piece, "*") ||
+                           pieceIs(piece, "**") || pieceIs(piece, "@")) {
+                    // Prefix when it cannot follow an operand
+                    piece.unary = prev == PieceKind::OPEN || prev == PieceKind::COMMA ||
+                                  prev == PieceKind::SEMICOLON || prev == PieceKind::COLON ||
+                                  prev == PieceKind::OPERATOR || prev == PieceKind::KEYWORD ||
+                                  prev == PieceKind::COMMENT;
+                }
+                break;
+            default:
+                break;
+        }
+
+        pieces.push_back(piece);
+    }
+    return true;
+}
+
+bool Formatter::spaceBetween(const Piece& prev, const Piece& cur) const {
+    if (prev.kind == PieceKind::OPEN || cur.kind == PieceKind::CLOSE) return false;
+    if (cur.kind == PieceKind::COMMA || cur.kind == PieceKind::SEMICOLON ||
+        cur.kind == PieceKind::COLON) {
+        return false;
+    }
+    if (prev.kind == PieceKind::COMMA || prev.kind == PieceKind::SEMICOLON) return true;
+    if (prev.kind == PieceKind::COLON) return !prev.tight;
+    if (prev.unary) return false;
+
+    bool touching = prev.offset + prev.length == cur.offset;
+    // "from . import x" is the only place a keyword meets a dot
+    if (prev.kind == PieceKind::DOT) return cur.kind == PieceKind::KEYWORD;
+    if (cur.kind == PieceKind::DOT) {
+        if (prev.kind == PieceKind::WORD) return !touching && isdigit(static_cast<unsigned char>(source[prev.offset]));
+        return prev.kind != PieceKind::CLOSE;
+    }
+
+    if (prev.tight || cur.tight) return false;
+    if (prev.kind == PieceKind::OPERATOR || cur.kind == PieceKind::OPERATOR) return true;
+    // A call or subscript hugs its operand; after a keyword it is a new expression
+    if (cur.kind == PieceKind::OPEN) return prev.kind == PieceKind::KEYWORD;
+    if (prev.kind == PieceKind::CLOSE) return true;
+    // Adjacent words are pieces of one literal the lexer splits, like f"..."
+    return !touching;
+}
+
+int Formatter::widthBefore(size_t offset) const {
+    size_t start = offset;
+    while (start > 0 && source[start - 1] != '\n') start--;
+    int width = 0;
+    for (size_t i = start; i < offset; i++) {
+        width += source[i] == '\t' ? 4 : 1;  // Tabs count as 4, as in the lexer
+    }
+    return width;
+}
+
+size_t Formatter::trimmedEnd(size_t offset, size_t end) const {
+    while (end > offset && isspace(static_cast<unsigned char>(source[end - 1]))) end--;
+    return end;
+}
+
+bool Formatter::pieceIs(const Piece& piece, const char* text) const {
+    return piece.length == strlen(text) && source.compare(piece.offset, piece.length, text) == 0;
+}
+
+void Formatter::appendIndent(int width) {
+    output.append(static_cast<size_t>(width), ' ');
+}
+
+void Formatter::addPendingComment(const Piece& comment) {
+    // A comment line takes the level of the block its column falls in, or
+    // opens the block a preceding ':' started
+    int width = widthBefore(comment.offset);
+    int depth = static_cast<int>(blockWidths.size()) - 1;
+    while (depth > 0 && blockWidths[depth] > width) depth--;
+    if (openerPending && width > blockWidths.back()) depth = static_cast<int>(blockWidths.size());
+    pending.push_back({true, comment.offset, comment.length, depth, 0});
+}
+
+void Formatter::flushPending(int depth, int required, bool firstInBlock, bool atEnd) {
+    int cap = depth == 0 ? 2 : 1;
+
+    // Comments directly above a statement at its own level stay attached
+    // to it; the statement's blank lines go above them
+    size_t attached = pending.size();
+    while (!atEnd && attached > 0 && pending[attached - 1].comment && pending[attached - 1].depth == depth) {
+        attached--;
+    }
+    size_t lastComment = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        if (pending[i].comment) lastComment = i + 1;
+    }
+
+    bool placed = false;
+    bool seenComment = false;
+    for (size_t i = 0; i <= pending.size(); i++) {
+        if (i == attached && !placed && required > 0 && !firstInBlock && !output.empty()) {
+            output.append(static_cast<size_t>(required), '\n');
+            placed = true;
+        }
+        if (i == pending.size()) break;
+
+        const PendingLine& line = pending[i];
+        if (line.comment) {
+            seenComment = true;
+            appendIndent(line.depth * INDENT_WIDTH);
+            output.append(source, line.offset, line.length);
+            output += '\n';
+            continue;
+        }
+
+        int blanks = min(line.blanks, cap);
+        // No blank lines open a block or the file, or close the file
+        if (output.empty() || (firstInBlock && !seenComment) || (atEnd && i >= lastComment)) {
+            blanks = 0;
+        } else if (required >= 0 && i + 1 == attached) {
+            blanks = required;
+            placed = true;
+        }
+        output.append(static_cast<size_t>(blanks), '\n');
+    }
+    pending.clear();
+}
+
+void Formatter::emitStatement(int depth, int statementWidth) {
+    appendIndent(depth * INDENT_WIDTH);
+    for (size_t i = 0; i < pieces.size(); i++) {
+        const Piece& cur = pieces[i];
+        if (i > 0) {
+            const Piece& prev = pieces[i - 1];
+            // Line breaks inside brackets or after a backslash are kept;
+            // continuation lines keep their indentation relative to the
+            // statement
+            bool newline = false;
+            bool backslash = false;
+            for (size_t p = prev.offset + prev.length; p < cur.offset; p++) {
+                if (source[p] == '\n') newline = true;
+                else if (source[p] == '\\') backslash = true;
+            }
+            if (newline) {
+                if (backslash) output += " \\";
+                output += '\n';
+                appendIndent(depth * INDENT_WIDTH + max(0, widthBefore(cur.offset) - statementWidth));
+            } else if (cur.kind == PieceKind::COMMENT) {
+                output += "  ";
+            } else if (spaceBetween(prev, cur)) {
+                output += ' ';
+            }
+        }
+        output.append(source, cur.offset, cur.length);
+    }
+    output += '\n';
+}
+
+vector<FormatResult> formatFiles(const vector<string>& paths, bool checkOnly, unsigned threads) {
+    vector<FormatResult> results(paths.size());
+    if (threads == 0) threads = max(1u, thread::hardware_concurrency());
+    if (threads > paths.size()) threads = static_cast<unsigned>(max<size_t>(1, paths.size()));
+
+    // Workers claim files one at a time, so a few large files do not
+    // leave the other threads idle
+    atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i = next++; i < paths.size(); i = next++) {
+            formatFile(paths[i], checkOnly, results[i]);
+        }
+    };
+
+    vector<thread> pool;
+    for (unsigned t = 1; t < threads; t++) pool.emplace_back(worker);
+    worker();
+    for (thread& t : pool) t.join();
+    return results;
+}
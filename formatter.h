@@ -0,0 +1,115 @@
+#ifndef FORMATTER_H
+#define FORMATTER_H
+
+#include <string>
+#include <vector>
+#include "lexer.h"
+
+using namespace std;
+
+// Rewrites Python source into a canonical layout:
+//   - block indentation is 4 spaces per level
+//   - one space around binary operators and after commas, none inside
+//     brackets, around keyword-argument '=' or around slice colons
+//   - two blank lines around top-level def/class, one around nested ones,
+//     at most two (top level) or one (nested) blank lines elsewhere
+//   - no trailing whitespace, exactly one newline at the end of the file
+// Comments, string literals and the line breaks inside brackets are kept.
+//
+// The formatter makes a single pass over the token stream, one logical line
+// at a time, appending to an output buffer reserved up front. Its output is
+// a fixed point: formatting it again changes nothing.
+class Formatter {
+public:
+    Formatter(const string& source);
+
+    // Returns false, leaving the output empty, if the source cannot be
+    // formatted safely (unterminated string, inconsistent dedent)
+    bool format();
+
+    const string& getOutput() const { return output; }
+    bool hasError() const { return errorOccurred; }
+    const string& getErrorMessage() const { return errorMessage; }
+    size_t getErrorOffset() const { return errorOffset; }
+
+private:
+    enum class PieceKind {
+        WORD,       // Identifier, number or string
+        KEYWORD,    // Word that is never called or subscripted
+        OPEN,
+        CLOSE,
+        COMMA,
+        SEMICOLON,
+        COLON,
+        DOT,
+        OPERATOR,   // Possibly compound, e.g. "**=" or "->"
+        COMMENT
+    };
+
+    // A run of source text emitted as one unit
+    struct Piece {
+        PieceKind kind;
+        size_t offset;
+        size_t length;
+        bool unary;  // Prefix operator: no space after it
+        bool tight;  // Keyword-argument '=' or slice ':': no spaces around it
+    };
+
+    // Per open bracket state that decides how ':' and '=' are spaced
+    struct Bracket {
+        char open;        // '(', '[', '{', or 0 outside brackets
+        bool annotated;   // A ':' was seen since the last ',' (parameter annotation)
+        bool lambdaArgs;  // Inside lambda parameters, before their ':'
+    };
+
+    // A blank-line run or comment line whose spacing depends on the next
+    // statement, so it is held back until that statement is seen
+    struct PendingLine {
+        bool comment;
+        size_t offset;
+        size_t length;
+        int depth;
+        int blanks;
+    };
+
+    string source;
+    Lexer lexer;
+    string output;
+    vector<Token> lineTokens;   // Reused for every logical line
+    vector<Piece> pieces;
+    vector<Bracket> brackets;
+    vector<PendingLine> pending;
+    vector<int> blockWidths;    // Original indentation width of each open block
+    vector<bool> lastWasDef;    // Whether the last statement at each depth was a def/class
+    bool openerPending;         // The previous statement ended with ':'
+    bool afterDecorator;
+    bool errorOccurred;
+    string errorMessage;
+    size_t errorOffset;
+
+    bool setError(const string& message, size_t offset);
+    size_t readLine();
+    bool buildPieces(size_t begin, size_t end);
+    bool spaceBetween(const Piece& prev, const Piece& cur) const;
+    int widthBefore(size_t offset) const;
+    size_t trimmedEnd(size_t offset, size_t end) const;
+    bool pieceIs(const Piece& piece, const char* text) const;
+    void appendIndent(int width);
+    void addPendingComment(const Piece& comment);
+    void flushPending(int depth, int required, bool firstInBlock, bool atEnd);
+    void emitStatement(int depth, int statementWidth);
+};
+
+struct FormatResult {
+    string path;
+    bool changed;   // Output differs from the file (and was written unless checking)
+    bool failed;
+    string message;
+};
+
+// Formats every file on a pool of worker threads. With checkOnly the files
+// are left untouched; otherwise changed files are rewritten in place.
+// threads == 0 uses one thread per hardware thread.
+vector<FormatResult> formatFiles(const vector<string>& paths, bool checkOnly, unsigned threads = 0);
+
+#endif // FORMATTER_H
@@ -4,10 +4,19 @@
 using namespace std;
 
 Lexer::Lexer(const string& input)
-    : input(input), position(0), line(1), column(1), errorOccurred(false) {
+    : input(input), position(0), tokenStart(0), lineIndex(input), bracketDepth(0), pendingDedents(0),
+      keepComments(false), errorOccurred(false), errorOffset(0) {
     indentationStack.push(0);  // Start with 0 indentation
 }
 
+void Lexer::reset(size_t offset) {
+    position = offset < input.length() ? offset : input.length();
+    indentationStack = stack<int>();
+    indentationStack.push(0);
+    bracketDepth = 0;
+    pendingDedents = 0;
+}
+
 char Lexer::peek() const {
     if (isAtEnd()) return '\0';
     return input[position];
@@ -15,14 +24,7 @@ char Lexer::peek() const {
 
 char Lexer::advance() {
     if (!isAtEnd()) {
-        char current = input[position++];
-        if (current == '\n') {
-            line++;
-            column = 1;
-        } else {
-            column++;
-        }
-        return current;
+        return input[position++];
     }
     return '\0';
 }
@@ -36,6 +38,13 @@ void Lexer::skipWhitespace() {
         char c = peek();
         if (c == ' ' || c == '\r' || c == '\t') {
             advance();
+        } else if (c == '\n' && bracketDepth > 0) {
+            advance();  // Newlines inside brackets are not significant
+        } else if (c == '\\' && position + 1 < input.length() &&
+                   (input[position + 1] == '\n' || input[position + 1] == '\r')) {
+            advance();  // Explicit line continuation
+            if (peek() == '\r') advance();
+            if (peek() == '\n') advance();
         } else {
             break;
         }
@@ -45,10 +54,50 @@ void Lexer::skipWhitespace() {
 bool Lexer::match(char expected) {
     if (isAtEnd() || input[position] != expected) return false;
     position++;
-    column++;
     return true;
 }
 
+bool Lexer::atLineStart() const {
+    return position == 0 || input[position - 1] == '\n';
+}
+
+void Lexer::fillToken(Token& out, TokenType type) const {
+    // Values are sliced from the source straight into the destination, so
+    // a reused token keeps its string capacity
+    out.type = type;
+    out.offset = tokenStart;
+    out.length = position - tokenStart;
+    switch (type) {
+        case TokenType::NEWLINE:
+            out.value.assign("\\n");
+            break;
+        case TokenType::INDENT:
+        case TokenType::DEDENT:
+        case TokenType::END_OF_FILE:
+            out.value.clear();
+            break;
+        case TokenType::STRING:
+            if (out.length >= 6 && input[tokenStart + 1] == input[tokenStart] &&
+                input[tokenStart + 2] == input[tokenStart]) {
+                out.value.assign(input, tokenStart + 3, out.length - 6);
+            } else {
+                out.value.assign(input, tokenStart + 1, out.length - 2);
+            }
+            break;
+        case TokenType::ERROR:
+            // Unterminated strings report their contents without the quote
+            if (input[tokenStart] == '"' || input[tokenStart] == '\'') {
+                out.value.assign(input, tokenStart + 1, out.length - 1);
+                break;
+            }
+            out.value.assign(input, tokenStart, out.length);
+            break;
+        default:
+            out.value.assign(input, tokenStart, out.length);
+            break;
+    }
+}
+
 bool Lexer::isDigit(char c) const {
     return c >= '0' && c <= '9';
 }
@@ -61,9 +110,11 @@ bool Lexer::isAlphaNumeric(char c) const {
     return isAlpha(c) || isDigit(c);
 }
 
-void Lexer::setError(const string& message) {
+void Lexer::setError(const string& message, size_t offset) {
     errorOccurred = true;
-    errorMessage = "Line " + to_string(line) + ", Column " + to_string(column) + ": " + message;
+    errorOffset = offset;
+    errorMessage = "Line " + to_string(lineIndex.lineOf(offset)) +
+                   ", Column " + to_string(lineIndex.columnOf(offset)) + ": " + message;
 }
 
 TokenType Lexer::checkKeyword(const string& identifier) const {
@@ -88,63 +139,103 @@ TokenType Lexer::checkKeyword(const string& identifier) const {
     return TokenType::IDENTIFIER;
 }
 
-Token Lexer::handleIdentifier() {
-    string identifier;
-    int startColumn = column;
-    
+TokenType Lexer::handleIdentifier() {
     while (!isAtEnd() && isAlphaNumeric(peek())) {
-        identifier += advance();
+        advance();
     }
     
-    TokenType type = checkKeyword(identifier);
-    return Token(type, identifier, line, startColumn);
+    // No keyword is longer than 8 characters
+    size_t length = position - tokenStart;
+    if (length > 8) return TokenType::IDENTIFIER;
+    return checkKeyword(input.substr(tokenStart, length));
 }
 
-Token Lexer::handleNumber() {
-    string number;
+TokenType Lexer::handleNumber() {
     bool isFloat = false;
-    int startColumn = column;
     
-    while (!isAtEnd() && (isDigit(peek()) || peek() == '.')) {
+    // Hexadecimal, octal and binary literals
+    if (peek() == '0' && position + 1 < input.length()) {
+        char base = input[position + 1];
+        if (base == 'x' || base == 'X' || base == 'o' || base == 'O' || base == 'b' || base == 'B') {
+            advance();
+            advance();
+            while (!isAtEnd() && isAlphaNumeric(peek())) advance();
+            return TokenType::INTEGER;
+        }
+    }
+    
+    while (!isAtEnd() && (isDigit(peek()) || peek() == '.' || peek() == '_')) {
         char c = peek();
         if (c == '.') {
             if (isFloat) {
-                setError("Invalid number format: multiple decimal points");
-                return Token(TokenType::ERROR, number, line, startColumn);
+                setError("Invalid number format: multiple decimal points", position);
+                return TokenType::ERROR;
             }
             isFloat = true;
         }
-        number += advance();
+        advance();
     }
     
-    return Token(isFloat ? TokenType::FLOAT : TokenType::INTEGER, number, line, startColumn);
+    // Exponent, e.g. 1e-5
+    if (peek() == 'e' || peek() == 'E') {
+        size_t digits = position + 1;
+        if (digits < input.length() && (input[digits] == '+' || input[digits] == '-')) digits++;
+        if (digits < input.length() && isDigit(input[digits])) {
+            while (position < digits) advance();
+            while (!isAtEnd() && (isDigit(peek()) || peek() == '_')) advance();
+            isFloat = true;
+        }
+    }
+    
+    // Imaginary suffix
+    if (peek() == 'j' || peek() == 'J') {
+        advance();
+        isFloat = true;
+    }
+    
+    return isFloat ? TokenType::FLOAT : TokenType::INTEGER;
 }
 
-Token Lexer::handleString() {
-    string str;
-    int startColumn = column;
+TokenType Lexer::handleString() {
     char quote = advance(); // Skip the opening quote
+    bool triple = peek() == quote && position + 1 < input.length() && input[position + 1] == quote;
+    if (triple) {
+        advance();
+        advance();
+    }
     
-    while (!isAtEnd() && peek() != quote) {
-        if (peek() == '\n') {
-            setError("Unterminated string literal");
-            return Token(TokenType::ERROR, str, line, startColumn);
+    while (!isAtEnd()) {
+        char c = peek();
+        if (c == '\\') {
+            advance(); // The escaped character never ends the string
+            advance();
+            continue;
         }
-        str += advance();
+        if (c == quote) {
+            if (!triple) break;
+            if (position + 2 < input.length() && input[position + 1] == quote && input[position + 2] == quote) break;
+        } else if (c == '\n' && !triple) {
+            setError("Unterminated string literal", tokenStart);
+            return TokenType::ERROR;
+        }
+        advance();
     }
     
     if (isAtEnd()) {
-        setError("Unterminated string literal");
-        return Token(TokenType::ERROR, str, line, startColumn);
+        setError("Unterminated string literal", tokenStart);
+        return TokenType::ERROR;
     }
     
     advance(); // Skip the closing quote
-    return Token(TokenType::STRING, str, line, startColumn);
+    if (triple) {
+        advance();
+        advance();
+    }
+    return TokenType::STRING;
 }
 
-Token Lexer::handleIndentation() {
+bool Lexer::handleIndentation(TokenType& type) {
     int spaces = 0;
-    int startColumn = column;
     
     while (peek() == ' ' || peek() == '\t') {
         if (peek() == ' ') spaces++;
@@ -152,17 +243,38 @@ Token Lexer::handleIndentation() {
         advance();
     }
     
+    // Blank and comment-only lines do not affect indentation
+    char c = peek();
+    if (isAtEnd() || c == '\n' || c == '\r' || c == '#') {
+        return false;
+    }
+    
     int currentIndent = indentationStack.top();
     
     if (spaces > currentIndent) {
         indentationStack.push(spaces);
-        return Token(TokenType::INDENT, "", line, startColumn);
+        type = TokenType::INDENT;
+        return true;
     } else if (spaces < currentIndent) {
-        indentationStack.pop();
-        return Token(TokenType::DEDENT, "", line, startColumn);
+        // Close every block deeper than this line; one DEDENT per block
+        int dedents = 0;
+        while (indentationStack.size() > 1 && indentationStack.top() > spaces) {
+            indentationStack.pop();
+            dedents++;
+        }
+        if (indentationStack.top() != spaces) {
+            setError("Unindent does not match any outer indentation level", position);
+        }
+        pendingDedents = dedents - 1;
+        type = TokenType::DEDENT;
+        return true;
     }
     
-    return getNextToken(); // Skip this token and get the next one
+    return false;
+}
+
+void Lexer::closeBracket() {
+    if (bracketDepth > 0) bracketDepth--;
 }
 
 void Lexer::handleComment() {
@@ -172,19 +284,54 @@ void Lexer::handleComment() {
 }
 
 Token Lexer::getNextToken() {
+    Token token(TokenType::END_OF_FILE, "", 0, 0);
+    nextToken(token);
+    return token;
+}
+
+void Lexer::nextToken(Token& out) {
+    TokenType type = scanToken();
+    fillToken(out, type);
+}
+
+size_t Lexer::nextBatch(Token* out, size_t count) {
+    size_t produced = 0;
+    while (produced < count) {
+        TokenType type = scanToken();
+        fillToken(out[produced++], type);
+        if (type == TokenType::END_OF_FILE) break;
+    }
+    return produced;
+}
+
+TokenType Lexer::scanToken() {
+    tokenStart = position;
+    if (pendingDedents > 0) {
+        pendingDedents--;
+        return TokenType::DEDENT;
+    }
+    
+    // Handle indentation at the start of a line
+    if (bracketDepth == 0 && atLineStart() && !isAtEnd()) {
+        TokenType type;
+        if (handleIndentation(type)) {
+            return type;
+        }
+    }
+    
     skipWhitespace();
+    tokenStart = position;
     
     if (isAtEnd()) {
-        return Token(TokenType::END_OF_FILE, "", line, column);
+        // Close any blocks still open at the end of input
+        if (indentationStack.size() > 1) {
+            indentationStack.pop();
+            return TokenType::DEDENT;
+        }
+        return TokenType::END_OF_FILE;
     }
     
     char c = peek();
-    int startColumn = column;
-    
-    // Handle indentation at the start of a line
-    if (column == 1 && c != '\n') {
-        return handleIndentation();
-    }
     
     // Handle different token types
     if (isAlpha(c)) {
@@ -198,54 +345,55 @@ Token Lexer::getNextToken() {
     switch (c) {
         case '\n':
             advance();
-            return Token(TokenType::NEWLINE, "\\n", line-1, startColumn);
+            return TokenType::NEWLINE;
             
         case '#':
             handleComment();
-            return getNextToken();
+            if (keepComments) return TokenType::COMMENT;
+            return scanToken();
             
         case '"':
         case '\'':
             return handleString();
             
-        case '+': advance(); return Token(TokenType::PLUS, "+", line, startColumn);
-        case '-': advance(); return Token(TokenType::MINUS, "-", line, startColumn);
-        case '*': advance(); return Token(TokenType::MULTIPLY, "*", line, startColumn);
-        case '/': advance(); return Token(TokenType::DIVIDE, "/", line, startColumn);
+        case '+': advance(); return TokenType::PLUS;
+        case '-': advance(); return TokenType::MINUS;
+        case '*': advance(); return TokenType::MULTIPLY;
+        case '/': advance(); return TokenType::DIVIDE;
         
         case '=':
             advance();
-            if (match('=')) return Token(TokenType::EQUALS, "==", line, startColumn);
-            return Token(TokenType::ASSIGN, "=", line, startColumn);
+            if (match('=')) return TokenType::EQUALS;
+            return TokenType::ASSIGN;
             
         case '!':
             advance();
-            if (match('=')) return Token(TokenType::NOT_EQUALS, "!=", line, startColumn);
-            setError("Expected '=' after '!'");
-            return Token(TokenType::ERROR, "!", line, startColumn);
+            if (match('=')) return TokenType::NOT_EQUALS;
+            setError("Expected '=' after '!'", tokenStart);
+            return TokenType::ERROR;
             
         case '<':
             advance();
-            if (match('=')) return Token(TokenType::LESS_EQUAL, "<=", line, startColumn);
-            return Token(TokenType::LESS_THAN, "<", line, startColumn);
+            if (match('=')) return TokenType::LESS_EQUAL;
+            return TokenType::LESS_THAN;
             
         case '>':
             advance();
-            if (match('=')) return Token(TokenType::GREATER_EQUAL, ">=", line, startColumn);
-            return Token(TokenType::GREATER_THAN, ">", line, startColumn);
+            if (match('=')) return TokenType::GREATER_EQUAL;
+            return TokenType::GREATER_THAN;
             
-        case '(': advance(); return Token(TokenType::LPAREN, "(", line, startColumn);
-        case ')': advance(); return Token(TokenType::RPAREN, ")", line, startColumn);
-        case '{': advance(); return Token(TokenType::LBRACE, "{", line, startColumn);
-        case '}': advance(); return Token(TokenType::RBRACE, "}", line, startColumn);
-        case '[': advance(); return Token(TokenType::LBRACKET, "[", line, startColumn);
-        case ']': advance(); return Token(TokenType::RBRACKET, "]", line, startColumn);
-        case ':': advance(); return Token(TokenType::COLON, ":", line, startColumn);
-        case ',': advance(); return Token(TokenType::COMMA, ",", line, startColumn);
-        case '.': advance(); return Token(TokenType::DOT, ".", line, startColumn);
-    }
-    
-    setError("Unexpected character: " + string(1, c));
+        case '(': advance(); bracketDepth++; return TokenType::LPAREN;
+        case ')': advance(); closeBracket(); return TokenType::RPAREN;
+        case '{': advance(); bracketDepth++; return TokenType::LBRACE;
+        case '}': advance(); closeBracket(); return TokenType::RBRACE;
+        case '[': advance(); bracketDepth++; return TokenType::LBRACKET;
+        case ']': advance(); closeBracket(); return TokenType::RBRACKET;
+        case ':': advance(); return TokenType::COLON;
+        case ',': advance(); return TokenType::COMMA;
+        case '.': advance(); return TokenType::DOT;
+    }
+    
+    setError("Unexpected character: " + string(1, c), tokenStart);
     advance();
-    return Token(TokenType::ERROR, string(1, c), line, startColumn);
+    return TokenType::ERROR;
 } 
\ No newline at end of file
@@ -5,6 +5,7 @@
 #include <vector>
 #include <stack>
 #include "token.h"
+#include "line_index.h"
 
 using namespace std;
 
@@ -12,17 +13,32 @@ class Lexer {
 public:
     Lexer(const string& input);
     Token getNextToken();
+    // Lexes the next token into out, reusing its storage
+    void nextToken(Token& out);
+    // Lexes up to count tokens into out; stops after END_OF_FILE.
+    // Returns the number of tokens written.
+    size_t nextBatch(Token* out, size_t count);
+    // Restarts lexing at offset with no open blocks or brackets
+    void reset(size_t offset);
+    // Emit COMMENT tokens instead of skipping comments
+    void setKeepComments(bool keep) { keepComments = keep; }
     bool hasError() const { return errorOccurred; }
     const string& getErrorMessage() const { return errorMessage; }
+    size_t getErrorOffset() const { return errorOffset; }
+    const LineIndex& getLineIndex() const { return lineIndex; }
 
 private:
     string input;
     size_t position;
-    int line;
-    int column;
+    size_t tokenStart;  // Offset where the token being scanned begins
+    LineIndex lineIndex;
     stack<int> indentationStack;
+    int bracketDepth;
+    int pendingDedents;
+    bool keepComments;
     bool errorOccurred;
     string errorMessage;
+    size_t errorOffset;
 
     // Helper methods
     char peek() const;
@@ -30,17 +46,22 @@ private:
     bool isAtEnd() const;
     void skipWhitespace();
     bool match(char expected);
+    bool atLineStart() const;
+    void fillToken(Token& out, TokenType type) const;
     
-    // Token processing methods
-    Token handleIdentifier();
-    Token handleNumber();
-    Token handleString();
-    Token handleOperator();
-    Token handleIndentation();
+    // Token processing methods; each returns the type of the token
+    // spanning [tokenStart, position)
+    TokenType scanToken();
+    TokenType handleIdentifier();
+    TokenType handleNumber();
+    TokenType handleString();
+    TokenType handleOperator();
+    bool handleIndentation(TokenType& type);
     void handleComment();
+    void closeBracket();
     
     // Error handling
-    void setError(const string& message);
+    void setError(const string& message, size_t offset);
     
     // Character classification helpers
     bool isDigit(char c) const;
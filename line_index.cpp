@@ -0,0 +1,46 @@
+#include "line_index.h"
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+LineIndex::LineIndex(const string& source) {
+    build(source.data(), source.length());
+}
+
+LineIndex::LineIndex(const char* data, size_t length) {
+    build(data, length);
+}
+
+void LineIndex::build(const char* data, size_t length) {
+    lineStarts.clear();
+    lineStarts.reserve(length / 32 + 1);
+    lineStarts.push_back(0);
+
+    // memchr is vectorized by the C library, so this is a single fast
+    // pass over the buffer rather than a byte-at-a-time loop.
+    const char* p = data;
+    const char* end = data + length;
+    while (p < end) {
+        const void* hit = memchr(p, '\n', end - p);
+        if (!hit) break;
+        p = static_cast<const char*>(hit) + 1;
+        lineStarts.push_back(p - data);
+    }
+}
+
+int LineIndex::lineOf(size_t offset) const {
+    // First line start strictly greater than offset, minus one
+    auto it = upper_bound(lineStarts.begin(), lineStarts.end(), offset);
+    return static_cast<int>(it - lineStarts.begin());
+}
+
+int LineIndex::columnOf(size_t offset) const {
+    return static_cast<int>(offset - lineStart(lineOf(offset))) + 1;
+}
+
+size_t LineIndex::lineStart(int line) const {
+    if (line < 1) return 0;
+    if (static_cast<size_t>(line) > lineStarts.size()) return lineStarts.back();
+    return lineStarts[line - 1];
+}
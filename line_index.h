@@ -0,0 +1,30 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+using namespace std;
+
+// Maps byte offsets in a source buffer to 1-based line/column pairs.
+// The source is scanned for newlines once; lookups are a binary search
+// over the recorded line-start offsets.
+class LineIndex {
+public:
+    LineIndex() : lineStarts(1, 0) {}
+    LineIndex(const string& source);
+    LineIndex(const char* data, size_t length);
+
+    int lineOf(size_t offset) const;
+    int columnOf(size_t offset) const;
+    size_t lineStart(int line) const;
+    size_t lineCount() const { return lineStarts.size(); }
+
+private:
+    vector<size_t> lineStarts;  // Offset of the first byte of each line
+
+    void build(const char* data, size_t length);
+};
+
+#endif // LINE_INDEX_H
@@ -1,7 +1,11 @@
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <chrono>
 #include "parser.h"
+#include "symbol_index.h"
+#include "formatter.h"
+#include "batch_reader.h"
 
 using namespace std;
 
@@ -21,8 +25,148 @@ string readMultilineInput()
     return input;
 }
 
-int main()
+void printIndexStats(const SymbolIndexBuilder::Stats &stats)
 {
+    cout << "Indexed " << stats.files << " files (" << stats.reparsed << " parsed, "
+         << stats.reused << " unchanged), " << stats.symbols << " symbols" << endl;
+}
+
+// --index <root> <index-file>    build or incrementally update an index
+// --watch <root> <index-file>    keep the index current as files change
+// --query <index-file> <name> [--prefix]
+int runIndexCommand(const string &mode, int argc, char *argv[])
+{
+    if (mode == "--query")
+    {
+        SymbolIndex index;
+        if (!index.open(argv[2]))
+        {
+            cout << "Error: " << index.getErrorMessage() << endl;
+            return 1;
+        }
+        bool prefix = argc > 4 && string(argv[4]) == "--prefix";
+        vector<IndexedSymbol> results = prefix ? index.findPrefix(argv[3]) : index.findExact(argv[3]);
+        for (const IndexedSymbol &symbol : results)
+        {
+            cout << symbol.file << ":" << symbol.line << ": " << symbol.kind << " "
+                 << symbol.name << " (scope " << symbol.scope << ")" << endl;
+        }
+        return results.empty() ? 1 : 0;
+    }
+
+    SymbolIndexBuilder builder;
+    bool ok = mode == "--watch"
+        ? builder.watch(argv[2], argv[3], printIndexStats)
+        : builder.update(argv[2], argv[3]);
+    if (!ok)
+    {
+        cout << "Error: " << builder.getErrorMessage() << endl;
+        return 1;
+    }
+    printIndexStats(builder.getStats());
+    return 0;
+}
+
+// --format [--check] <file>...   rewrite files in place, or with --check
+//                               only report the ones that would change
+int runFormatCommand(int argc, char *argv[])
+{
+    bool checkOnly = string(argv[2]) == "--check";
+    vector<string> paths(argv + (checkOnly ? 3 : 2), argv + argc);
+
+    size_t changed = 0, failed = 0;
+    for (const FormatResult &result : formatFiles(paths, checkOnly))
+    {
+        if (result.failed)
+        {
+            cout << "Error: " << result.path << ": " << result.message << endl;
+            failed++;
+        }
+        else if (result.changed)
+        {
+            cout << (checkOnly ? "Would reformat " : "Reformatted ") << result.path << endl;
+            changed++;
+        }
+    }
+    cout << changed << " of " << paths.size() << " files " << (checkOnly ? "would be " : "")
+         << "reformatted" << (failed ? ", " + to_string(failed) + " failed" : "") << endl;
+    return failed > 0 || (checkOnly && changed > 0) ? 1 : 0;
+}
+
+// --batch <file>...   parse many files, overlapping reads with parsing
+int runBatchCommand(int argc, char *argv[])
+{
+    typedef chrono::steady_clock Clock;
+    vector<string> paths(argv + 2, argv + argc);
+    size_t parsed = 0, failed = 0, bytes = 0;
+    Clock::duration parseTime(0);
+
+    BatchReader reader;
+    Clock::time_point start = Clock::now();
+    bool ok = reader.read(paths,
+        [&](const string &path, const string &contents)
+        {
+            Clock::time_point parseStart = Clock::now();
+            Parser parser(contents);
+            parser.setRecordTables(false);
+            parser.parse();
+            parseTime += Clock::now() - parseStart;
+
+            parsed++;
+            bytes += contents.size();
+            if (parser.hasError())
+            {
+                cout << path << ": " << parser.getErrorMessage() << endl;
+                failed++;
+            }
+        },
+        [&](const string &path, const string &message)
+        {
+            cout << "Error: " << path << ": " << message << endl;
+            failed++;
+        });
+    double totalMs = chrono::duration<double, milli>(Clock::now() - start).count();
+    double parseMs = chrono::duration<double, milli>(parseTime).count();
+    if (!ok)
+    {
+        cout << "Error: " << reader.getErrorMessage() << endl;
+        return 1;
+    }
+
+    cout << "Parsed " << parsed << " files (" << bytes << " bytes) via " << reader.getBackend()
+         << " in " << totalMs << " ms; parsing took " << parseMs << " ms";
+    if (parsed > 0)
+    {
+        cout << " (" << totalMs * 1000 / parsed << " us/file overall, "
+             << parseMs * 1000 / parsed << " us/file parsing)";
+    }
+    cout << endl;
+    return failed > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc >= 3 && string(argv[1]) == "--batch")
+    {
+        return runBatchCommand(argc, argv);
+    }
+    if (argc >= 3 && string(argv[1]) == "--format")
+    {
+        return runFormatCommand(argc, argv);
+    }
+
+    if (argc >= 4)
+    {
+        string mode = argv[1];
+        if (mode == "--index" || mode == "--watch" || mode == "--query")
+        {
+            return runIndexCommand(mode, argc, argv);
+        }
+    }
+
+    // --outline lists function headers without parsing their bodies
+    bool outlineOnly = argc > 1 && string(argv[1]) == "--outline";
+
     cout << "Python Parser Version " << VERSION << endl;
     
     while (true)
@@ -35,7 +179,15 @@ int main()
         }
 
         Parser parser(input);
-        parser.parse();
+        if (outlineOnly)
+        {
+            parser.preParse();
+            parser.printFunctionStubs(cout);
+        }
+        else
+        {
+            parser.parse();
+        }
 
         if (parser.hasError())
         {
@@ -43,8 +195,12 @@ int main()
         }
         else
         {
+            if (!outlineOnly)
+            {
+                parser.printSymbolTable(cout);
+                parser.printTokenTable(cout);
+            }
             cout << "\nNo syntax errors found!" << endl;
-            // Symbol and token tables are automatically printed by the parser
         }
 
         cout << "\nCtrl+Z (Windows) twice to exit, or continue entering code.\n" << endl;
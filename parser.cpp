@@ -1,8 +1,7 @@
 #include "parser.h"
 #include <cctype>
-#include <stack>
+#include <algorithm>
 #include <iomanip>
-#include <iostream>
 
 using namespace std;
 
@@ -38,72 +37,126 @@ string Parser::tokenTypeToString(TokenType type) const {
     }
 }
 
-void Parser::addSymbol(const string& name, const string& type, const string& dataType) {
+void Parser::addSymbol(const string& name, const string& type, const string& dataType, size_t offset) {
     SymbolInfo info;
     info.type = type;
     info.dataType = dataType;
-    info.lineNumber = currentLine;
+    info.offset = offset;
     info.scope = currentScope;
-    symbolTable[name] = info;
+    if (visitor)
+        visitor->onSymbol(name, info);
+    if (recordTables)
+        symbolTable[name] = info;
 }
 
-void Parser::addToken(const string& lexeme, const string& tokenType) {
+void Parser::addToken(const string& lexeme, const string& tokenType, size_t offset) {
     TokenInfo info;
     info.lexeme = lexeme;
     info.tokenType = tokenType;
-    info.lineNumber = currentLine;
-    info.column = currentPos - lexeme.length() + 1;
-    tokenTable.push_back(info);
+    info.offset = offset;
+    if (visitor)
+        visitor->onToken(info);
+    if (recordTables)
+        tokenTable.push_back(info);
 }
 
-void Parser::printSymbolTable() const {
-    cout << "\nSymbol Table:\n";
-    cout << setw(20) << left << "Name"
+void Parser::setError(const string& message, size_t offset) {
+    error = true;
+    errorOccurred = true;
+    errorOffset = offset;
+    errorMessage = message + " at line " + to_string(lineOf(offset));
+    if (visitor)
+        visitor->onDiagnostic(Diagnostic{errorMessage, offset});
+}
+
+void Parser::clearError() {
+    error = false;
+    errorOccurred = false;
+    errorMessage.clear();
+    errorOffset = 0;
+    requiresIndent = false;
+}
+
+void Parser::printSymbolTable(ostream &out) const {
+    out << "\nSymbol Table:\n";
+    out << setw(20) << left << "Name"
          << setw(15) << left << "Type"
          << setw(15) << left << "Data Type"
          << setw(10) << left << "Line"
          << setw(10) << left << "Scope" << endl;
-    cout << string(70, '-') << endl;
+    out << string(70, '-') << endl;
 
     for (const auto& entry : symbolTable) {
-        cout << setw(20) << left << entry.first
+        out << setw(20) << left << entry.first
              << setw(15) << left << entry.second.type
              << setw(15) << left << entry.second.dataType
-             << setw(10) << left << entry.second.lineNumber
+             << setw(10) << left << lineOf(entry.second.offset)
              << setw(10) << left << entry.second.scope << endl;
     }
-    cout << endl;
+    out << endl;
 }
 
-void Parser::printTokenTable() const {
-    cout << "\nLexemes and Tokens Table:\n";
-    cout << setw(20) << left << "Lexeme"
+void Parser::printTokenTable(ostream &out) const {
+    out << "\nLexemes and Tokens Table:\n";
+    out << setw(20) << left << "Lexeme"
          << setw(25) << left << "Token Type"
          << setw(10) << left << "Line"
          << setw(10) << left << "Column" << endl;
-    cout << string(65, '-') << endl;
+    out << string(65, '-') << endl;
 
     for (const auto& token : tokenTable) {
-        cout << setw(20) << left << token.lexeme
+        out << setw(20) << left << token.lexeme
              << setw(25) << left << token.tokenType
-             << setw(10) << left << token.lineNumber
-             << setw(10) << left << token.column << endl;
+             << setw(10) << left << lineOf(token.offset)
+             << setw(10) << left << columnOf(token.offset) << endl;
     }
-    cout << endl;
+    out << endl;
 }
 
 void Parser::skipWhitespace()
 {
-    while (currentPos < code.length() && isspace(code[currentPos]))
+    while (currentPos < parseEnd &&
+           (code[currentPos] == ' ' || code[currentPos] == '\t' || code[currentPos] == '\r'))
     {
-        if (code[currentPos] == '\n')
-        {
-            currentLine++;
-        }
         currentPos++;
     }
 }
 
+void Parser::syncTokens(size_t offset)
+{
+    // The stream only moves forward; bodies parsed out of order restart it
+    if (peekToken().offset > offset)
+        tokens.seek(offset);
+
+    while (peekToken().type != TokenType::END_OF_FILE &&
+           (peekToken().offset < offset ||
+            peekToken().type == TokenType::INDENT ||
+            peekToken().type == TokenType::DEDENT ||
+            peekToken().type == TokenType::NEWLINE))
+    {
+        advance();
+    }
+}
+
+void Parser::advance()
+{
+    tokens.advance();
+}
+
+bool Parser::match(TokenType type)
+{
+    if (peekToken().type != type)
+        return false;
+    advance();
+    return true;
+}
+
+void Parser::consume(TokenType type, const string &message)
+{
+    if (!match(type))
+        setError(message, peekToken().offset);
+}
+
 bool Parser::isIdentifierChar(char c)
 {
     return isalnum(c) || c == '_';
@@ -117,7 +170,7 @@ bool Parser::isNumber(char c)
 void Parser::parseIndentation()
 {
     int spaces = 0;
-    while (currentPos < code.length() && code[currentPos] == ' ')
+    while (currentPos < parseEnd && code[currentPos] == ' ')
     {
         spaces++;
         currentPos++;
@@ -125,20 +178,18 @@ void Parser::parseIndentation()
 
     // Skip empty lines
     size_t tempPos = currentPos;
-    while (tempPos < code.length() && code[tempPos] != '\n')
+    while (tempPos < parseEnd && code[tempPos] != '\n')
     {
         if (!isspace(code[tempPos]) && code[tempPos] != '#')
             break;
         tempPos++;
     }
-    if (tempPos < code.length() && (code[tempPos] == '\n' || code[tempPos] == '#'))
+    if (tempPos < parseEnd && (code[tempPos] == '\n' || code[tempPos] == '#'))
         return;
 
     if (spaces % 4 != 0)
     {
-        error = true;
-        errorOccurred = true;
-        errorMessage = "Indentation must be a multiple of 4 spaces at line " + to_string(currentLine);
+        setError("Indentation must be a multiple of 4 spaces", currentPos);
         return;
     }
 
@@ -147,17 +198,13 @@ void Parser::parseIndentation()
     // Check if we're inside a block that requires indentation
     if (requiresIndent && newLevel == 0)
     {
-        error = true;
-        errorOccurred = true;
-        errorMessage = "Expected indented block at line " + to_string(currentLine);
+        setError("Expected indented block", currentPos);
         return;
     }
     
     if (newLevel > indentLevel + 1)
     {
-        error = true;
-        errorOccurred = true;
-        errorMessage = "Too many indentation levels at line " + to_string(currentLine);
+        setError("Too many indentation levels", currentPos);
         return;
     }
 
@@ -165,154 +212,394 @@ void Parser::parseIndentation()
     requiresIndent = false;
 }
 
-void Parser::parseStatement()
+void Parser::parseStatement(const LogicalLine &logicalLine)
 {
     skipWhitespace();
 
-    if (currentPos >= code.length())
+    size_t lineEnd = min(logicalLine.end, parseEnd);
+    if (currentPos >= lineEnd)
     {
+        currentPos = lineEnd < parseEnd ? lineEnd + 1 : parseEnd;
         return;
     }
 
-    // Check for basic syntax elements
-    if (code[currentPos] == '#')
-    {
-        string comment;
-        while (currentPos < code.length() && code[currentPos] != '\n')
-        {
-            comment += code[currentPos];
-            currentPos++;
-        }
-        addToken(comment, "COMMENT");
-        return;
-    }
-
-    // Store the start of the line for checking
+    // Walk the line's structurals: brackets and comments inside string
+    // literals never appear in the index, and brackets may span lines.
     size_t lineStart = currentPos;
-    size_t lineEnd = code.find('\n', currentPos);
-    if (lineEnd == string::npos)
+    string line;
+    size_t segmentStart = lineStart;
+    vector<size_t> brackets;
+    const vector<size_t> &structurals = structure.getStructurals();
+    size_t last = logicalLine.firstStructural + logicalLine.structuralCount;
+    for (size_t i = logicalLine.firstStructural; i < last; i++)
     {
-        lineEnd = code.length();
-    }
+        size_t pos = structurals[i];
+        if (pos < lineStart)
+            continue; // Inline bodies start mid-line
+        if (pos >= lineEnd)
+            break;
 
-    string line = code.substr(lineStart, lineEnd - lineStart);
-    
-    // Check parentheses matching
-    stack<char> brackets;
-    for (size_t i = 0; i < line.length(); i++)
-    {
-        char c = line[i];
-        if (c == '(' || c == '[' || c == '{')
+        char c = code[pos];
+        if (c == '#')
+        {
+            size_t commentEnd = code.find('\n', pos);
+            if (commentEnd == string::npos || commentEnd > lineEnd)
+                commentEnd = lineEnd;
+            addToken(code.substr(pos, commentEnd - pos), "COMMENT", pos);
+            // Drop the comment from the statement text
+            line.append(code, segmentStart, pos - segmentStart);
+            segmentStart = commentEnd;
+        }
+        else if (c == '(' || c == '[' || c == '{')
         {
-            brackets.push(c);
-            addToken(string(1, c), "DELIMITER");
+            brackets.push_back(pos);
+            addToken(string(1, c), "DELIMITER", pos);
         }
         else if (c == ')' || c == ']' || c == '}')
         {
             if (brackets.empty())
             {
-                error = true;
-                errorOccurred = true;
-                errorMessage = "Unmatched closing bracket at line " + to_string(currentLine);
+                setError("Unmatched closing bracket", pos);
                 return;
             }
-            char open = brackets.top();
-            brackets.pop();
-            addToken(string(1, c), "DELIMITER");
+            char open = code[brackets.back()];
+            brackets.pop_back();
+            addToken(string(1, c), "DELIMITER", pos);
             if ((c == ')' && open != '(') ||
                 (c == ']' && open != '[') ||
                 (c == '}' && open != '{'))
             {
-                error = true;
-                errorOccurred = true;
-                errorMessage = "Mismatched brackets at line " + to_string(currentLine);
+                setError("Mismatched brackets", pos);
                 return;
             }
         }
     }
     if (!brackets.empty())
     {
-        error = true;
-        errorOccurred = true;
-        errorMessage = "Unclosed bracket at line " + to_string(currentLine);
+        setError("Unclosed bracket", brackets.back());
         return;
     }
-    
-    // Trim trailing comments from the line
-    size_t commentPos = line.find('#');
-    if (commentPos != string::npos)
+    line.append(code, segmentStart, lineEnd - segmentStart);
+
+    // Comment-only lines have no statement to classify
+    if (line.find_first_not_of(" \t\r") == string::npos)
     {
-        string comment = line.substr(commentPos);
-        addToken(comment, "COMMENT");
-        line = line.substr(0, commentPos);
+        currentPos = lineEnd < parseEnd ? lineEnd + 1 : parseEnd;
+        return;
     }
 
     // Check for statements that require colons
-    if (line.find("def ") == 0)
+    syncTokens(lineStart);
+    if (peekToken().type == TokenType::DEF)
     {
-        size_t nameStart = 4; // after "def "
-        size_t nameEnd = line.find('(');
-        if (nameEnd != string::npos)
+        const Token &name = peekToken(1);
+        if (name.type == TokenType::IDENTIFIER && peekToken(2).type == TokenType::LPAREN)
         {
-            string funcName = line.substr(nameStart, nameEnd - nameStart);
-            addSymbol(funcName, "Function", "void");
-            addToken("def", "KEYWORD");
-            addToken(funcName, "IDENTIFIER");
+            addSymbol(name.value, "Function", "void", name.offset);
+            addToken("def", "KEYWORD", peekToken().offset);
+            addToken(name.value, "IDENTIFIER", name.offset);
         }
     }
-    else if (line.find("if ") == 0 || 
-             line.find("elif ") == 0 || 
-             line.find("else") == 0 ||
-             line.find("while ") == 0 ||
-             line.find("for ") == 0 ||
-             line.find("class ") == 0)
+    else if (isCompoundKeyword(peekToken(), peekToken(1)))
+    {
+        addToken(peekToken().value, "KEYWORD", peekToken().offset);
+    }
+    else
     {
-        string keyword = line.substr(0, line.find(' '));
-        addToken(keyword, "KEYWORD");
+        parseAssignment();
     }
 
-    // Check for variable assignments
-    size_t assignPos = line.find('=');
-    if (assignPos != string::npos && line[assignPos + 1] != '=')
+    // Move to next logical line
+    currentPos = lineEnd < parseEnd ? lineEnd + 1 : parseEnd;
+}
+
+bool Parser::isCompoundKeyword(const Token &first, const Token &second) const
+{
+    switch (first.type)
+    {
+        case TokenType::IF:
+        case TokenType::ELIF:
+        case TokenType::ELSE:
+        case TokenType::WHILE:
+        case TokenType::FOR:
+            return true;
+        case TokenType::IDENTIFIER:
+            // 'class' is not a lexer keyword; it must be followed by a name
+            return first.value == "class" && second.type == TokenType::IDENTIFIER;
+        default:
+            return false;
+    }
+}
+
+void Parser::parseAssignment()
+{
+    // Targets are IDENTIFIER (',' IDENTIFIER)* followed by '='; looking
+    // ahead keeps calls, comparisons and augmented assignments out
+    size_t k = 0;
+    if (peekToken().type == TokenType::IDENTIFIER && peekToken(1).type == TokenType::COLON)
+    {
+        parseAnnotatedAssignment();
+        return;
+    }
+    while (peekToken(k).type == TokenType::IDENTIFIER)
     {
-        string varName = line.substr(0, assignPos);
-        // Trim whitespace
-        varName.erase(0, varName.find_first_not_of(" \t"));
-        varName.erase(varName.find_last_not_of(" \t") + 1);
-        if (!varName.empty())
+        const Token &next = peekToken(k + 1);
+        if (next.type == TokenType::ASSIGN)
         {
-            addSymbol(varName, "Variable", "unknown");
-            addToken(varName, "IDENTIFIER");
-            addToken("=", "OPERATOR");
+            for (size_t i = 0; i <= k; i += 2)
+            {
+                const Token &target = peekToken(i);
+                addSymbol(target.value, "Variable", "unknown", target.offset);
+                addToken(target.value, "IDENTIFIER", target.offset);
+            }
+            addToken("=", "OPERATOR", next.offset);
+            return;
         }
+        if (next.type != TokenType::COMMA || k + 3 >= TokenBuffer::MAX_LOOKAHEAD)
+            return;
+        k += 2;
     }
+}
 
-    // Move to next line
-    currentPos = lineEnd;
-    if (currentPos < code.length())
+void Parser::parseAnnotatedAssignment()
+{
+    // IDENTIFIER ':' annotation '='; a plain-name annotation becomes the
+    // symbol's data type
+    const Token &target = peekToken();
+    int depth = 0;
+    for (size_t k = 2; k < TokenBuffer::MAX_LOOKAHEAD; k++)
     {
-        currentPos++;
-        currentLine++;
+        const Token &token = peekToken(k);
+        switch (token.type)
+        {
+            case TokenType::LPAREN:
+            case TokenType::LBRACKET:
+            case TokenType::LBRACE:
+                depth++;
+                break;
+            case TokenType::RPAREN:
+            case TokenType::RBRACKET:
+            case TokenType::RBRACE:
+                depth--;
+                break;
+            case TokenType::ASSIGN:
+                if (depth == 0 && k > 2)
+                {
+                    bool simpleType = k == 3 && peekToken(2).type == TokenType::IDENTIFIER;
+                    addSymbol(target.value, "Variable", simpleType ? peekToken(2).value : "unknown", target.offset);
+                    addToken(target.value, "IDENTIFIER", target.offset);
+                    addToken("=", "OPERATOR", token.offset);
+                    return;
+                }
+                break;
+            case TokenType::NEWLINE:
+            case TokenType::END_OF_FILE:
+                return;
+            default:
+                break;
+        }
     }
 }
 
-void Parser::parse()
+void Parser::parseLines()
 {
-    while (currentPos < code.length() && !error)
+    const vector<LogicalLine> &lines = structure.getLogicalLines();
+    for (size_t i = structure.lineAt(currentPos); i < lines.size() && !error; i++)
     {
+        if (lines[i].begin >= parseEnd)
+            break;
+        currentPos = lines[i].begin;
+
         parseIndentation();
         if (error)
             return;
 
-        parseStatement();
+        parseStatement(lines[i]);
         if (error)
             return;
     }
-    
-    // After successful parsing, print the tables
-    if (!error)
+}
+
+void Parser::parse()
+{
+    // Each call starts over, so a parser can be run more than once
+    currentPos = 0;
+    parseEnd = code.length();
+    indentLevel = 0;
+    currentScope = 0;
+    clearError();
+    symbolTable.clear();
+    tokenTable.clear();
+    parseLines();
+}
+
+int Parser::measureIndent(size_t &pos) const
+{
+    int width = 0;
+    while (pos < parseEnd && (code[pos] == ' ' || code[pos] == '\t'))
     {
-        printSymbolTable();
-        printTokenTable();
+        width += code[pos] == ' ' ? 1 : 4; // Tabs count as 4 spaces, as in the lexer
+        pos++;
     }
-}
\ No newline at end of file
+    return width;
+}
+
+size_t Parser::recordFunctionStub(size_t lineIndex, size_t defPos, int indent)
+{
+    const vector<LogicalLine> &lines = structure.getLogicalLines();
+    const vector<size_t> &structurals = structure.getStructurals();
+    const LogicalLine &header = lines[lineIndex];
+    size_t headerEnd = header.end;
+
+    FunctionStub stub;
+    stub.headerOffset = defPos;
+    stub.indentLevel = indent / 4;
+    stub.inlineBody = false;
+    stub.bodyParsed = false;
+    stub.bodyValid = false;
+
+    // Name runs from after "def " up to the opening parenthesis
+    size_t nameStart = defPos + 4;
+    while (nameStart < headerEnd && code[nameStart] == ' ')
+        nameStart++;
+    size_t paren = code.find('(', nameStart);
+    if (paren == string::npos || paren > headerEnd)
+        paren = headerEnd;
+    stub.name = code.substr(nameStart, paren - nameStart);
+    stub.name.erase(stub.name.find_last_not_of(" \t") + 1);
+
+    // Signature is the parameter list up to the matching parenthesis, and
+    // the first comment after it bounds any inline body
+    size_t signatureEnd = headerEnd;
+    size_t commentPos = headerEnd;
+    int depth = 0;
+    size_t last = header.firstStructural + header.structuralCount;
+    for (size_t i = header.firstStructural; i < last; i++)
+    {
+        size_t pos = structurals[i];
+        char c = code[pos];
+        if (pos < paren)
+            continue;
+        if (c == '#')
+        {
+            if (signatureEnd < headerEnd)
+            {
+                commentPos = pos;
+                break;
+            }
+        }
+        else if (signatureEnd < headerEnd)
+        {
+            continue;
+        }
+        else if (c == '(' || c == '[' || c == '{')
+        {
+            depth++;
+        }
+        else if ((c == ')' || c == ']' || c == '}') && --depth == 0)
+        {
+            signatureEnd = pos + 1;
+        }
+    }
+    stub.signature = code.substr(paren, signatureEnd - paren);
+
+    // A statement after the colon on the header line is an inline body
+    size_t colon = code.find(':', signatureEnd);
+    size_t bodyStart = colon == string::npos || colon > commentPos ? commentPos : colon + 1;
+    while (bodyStart < commentPos && (code[bodyStart] == ' ' || code[bodyStart] == '\t' || code[bodyStart] == '\r'))
+        bodyStart++;
+
+    size_t lastLine = lineIndex;
+    if (bodyStart < commentPos)
+    {
+        stub.inlineBody = true;
+        stub.bodyBegin = bodyStart;
+        stub.bodyEnd = headerEnd;
+    }
+    else
+    {
+        // Body is every following logical line indented deeper than the
+        // header; blank and comment-only lines do not end it.
+        stub.bodyBegin = headerEnd < parseEnd ? headerEnd + 1 : parseEnd;
+        stub.bodyEnd = stub.bodyBegin;
+        for (size_t i = lineIndex + 1; i < lines.size(); i++)
+        {
+            size_t textPos = lines[i].begin;
+            int lineIndent = measureIndent(textPos);
+            if (textPos >= lines[i].end || code[textPos] == '\r' || code[textPos] == '#')
+                continue;
+            if (lineIndent <= indent)
+                break;
+            stub.bodyEnd = lines[i].end < parseEnd ? lines[i].end + 1 : parseEnd;
+            lastLine = i;
+        }
+    }
+
+    addSymbol(stub.name, "Function", "void", nameStart);
+    functionStubs.push_back(stub);
+    return lastLine;
+}
+
+void Parser::preParse()
+{
+    parseEnd = code.length();
+    functionStubs.clear();
+
+    const vector<LogicalLine> &lines = structure.getLogicalLines();
+    for (size_t i = 0; i < lines.size(); i++)
+    {
+        size_t pos = lines[i].begin;
+        int indent = measureIndent(pos);
+        if (code.compare(pos, 4, "def ") == 0)
+        {
+            i = recordFunctionStub(i, pos, indent);
+        }
+    }
+}
+
+bool Parser::parseFunctionBody(size_t index)
+{
+    if (index >= functionStubs.size())
+        return false;
+
+    FunctionStub &stub = functionStubs[index];
+    if (!stub.bodyParsed)
+    {
+        // Each body is an independent parse; an error in an earlier one
+        // must not stop this one
+        clearError();
+        currentPos = stub.bodyBegin;
+        parseEnd = stub.bodyEnd;
+        if (stub.inlineBody)
+        {
+            parseStatement(structure.getLogicalLines()[structure.lineAt(stub.bodyBegin)]);
+        }
+        else
+        {
+            indentLevel = stub.indentLevel;
+            parseLines();
+        }
+        stub.bodyParsed = true;
+        stub.bodyValid = !error;
+    }
+    return stub.bodyValid;
+}
+
+void Parser::printFunctionStubs(ostream &out) const {
+    out << "\nFunction Outline:\n";
+    out << setw(20) << left << "Name"
+         << setw(30) << left << "Signature"
+         << setw(10) << left << "Line"
+         << setw(10) << left << "Body" << endl;
+    out << string(70, '-') << endl;
+
+    for (const auto& stub : functionStubs) {
+        string body = stub.inlineBody ? "inline"
+            : to_string(lineOf(stub.bodyBegin)) + "-" + to_string(lineOf(stub.bodyEnd > stub.bodyBegin ? stub.bodyEnd - 1 : stub.bodyBegin));
+        out << setw(20) << left << stub.name
+             << setw(30) << left << stub.signature
+             << setw(10) << left << lineOf(stub.headerOffset)
+             << setw(10) << left << body << endl;
+    }
+    out << endl;
+}
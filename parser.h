@@ -2,24 +2,57 @@
 #define PARSER_H
 
 #include "lexer.h"
+#include "token_buffer.h"
+#include "structural_index.h"
 #include <vector>
 #include <string>
 #include <unordered_map>
+#include <ostream>
 
 using namespace std;
 
+// Positions are stored as byte offsets into the parsed source; use
+// Parser::lineOf / Parser::columnOf to turn them into line and column.
 struct SymbolInfo {
     string type;      // Variable, Function, Class, etc.
     string dataType;  // int, float, string, etc.
-    int lineNumber;
+    size_t offset;    // Byte offset of the defining occurrence
     int scope;        // Scope level where symbol is defined
 };
 
 struct TokenInfo {
     string lexeme;
     string tokenType;
-    int lineNumber;
-    int column;
+    size_t offset;    // Byte offset of the first character
+};
+
+struct Diagnostic {
+    string message;   // Full message, including the line number
+    size_t offset;    // Byte offset the diagnostic refers to
+};
+
+// Push-style consumer of parse results. Callbacks fire as each token,
+// symbol and diagnostic is produced, before parse() returns.
+class ParseVisitor {
+public:
+    virtual ~ParseVisitor() {}
+    virtual void onToken(const TokenInfo & /*token*/) {}
+    virtual void onSymbol(const string & /*name*/, const SymbolInfo & /*symbol*/) {}
+    virtual void onDiagnostic(const Diagnostic & /*diagnostic*/) {}
+};
+
+// A function header recorded by Parser::preParse. Its body is located by
+// indentation only and is not parsed until Parser::parseFunctionBody.
+struct FunctionStub {
+    string name;
+    string signature;     // Parameter list including parentheses
+    size_t headerOffset;  // Byte offset of the 'def' keyword
+    size_t bodyBegin;     // First byte of the body
+    size_t bodyEnd;       // One past the last byte of the body
+    int indentLevel;      // Indentation level of the header line
+    bool inlineBody;      // Body follows the colon on the header line
+    bool bodyParsed;
+    bool bodyValid;       // Parsing the body reported no error
 };
 
 class Parser
@@ -27,61 +60,91 @@ class Parser
 public:
     Parser(const string &input) : 
         lexer(input), 
-        currentToken(TokenType::ERROR, "", 0, 0),
+        tokens(lexer),
         errorOccurred(false), 
+        errorOffset(0),
         code(input), 
+        structure(code),
         currentPos(0), 
-        currentLine(1), 
+        parseEnd(input.length()),
         indentLevel(0),
         requiresIndent(false),
         currentScope(0),
-        error(false) {}
+        error(false),
+        visitor(nullptr),
+        recordTables(true) {}
     void parse();
+
+    // Lazy mode: record function headers and skip their bodies, then
+    // parse individual bodies on request.
+    void preParse();
+    bool parseFunctionBody(size_t index);
+    const vector<FunctionStub>& getFunctionStubs() const { return functionStubs; }
+    void printFunctionStubs(ostream &out) const;
     bool hasError() const { return errorOccurred; }
     const string &getErrorMessage() const { return errorMessage; }
+    void setVisitor(ParseVisitor *v) { visitor = v; }
+    // With recording off, results only reach the visitor and the tables stay empty
+    void setRecordTables(bool record) { recordTables = record; }
+    size_t getErrorOffset() const { return errorOffset; }
+    int lineOf(size_t offset) const { return lexer.getLineIndex().lineOf(offset); }
+    int columnOf(size_t offset) const { return lexer.getLineIndex().columnOf(offset); }
     
     // New methods for symbol and token tables
-    void printSymbolTable() const;
-    void printTokenTable() const;
+    void printSymbolTable(ostream &out) const;
+    void printTokenTable(ostream &out) const;
     const unordered_map<string, SymbolInfo>& getSymbolTable() const { return symbolTable; }
     const vector<TokenInfo>& getTokenTable() const { return tokenTable; }
 
 private:
     Lexer lexer;
-    Token currentToken;
+    TokenBuffer tokens;
     bool errorOccurred;
     string errorMessage;
+    size_t errorOffset;
     
     // Parser state
     string code;
+    StructuralIndex structure;  // Whole source, also in lazy mode: body ends depend on string state
     size_t currentPos;
-    int currentLine;
+    size_t parseEnd;      // End of the range currently being parsed
     int indentLevel;
     bool requiresIndent;
     int currentScope;
     bool error;
+    ParseVisitor *visitor;
+    bool recordTables;
 
     // Symbol and token tables
     unordered_map<string, SymbolInfo> symbolTable;
     vector<TokenInfo> tokenTable;
+    vector<FunctionStub> functionStubs;
 
     // Helper methods
     void skipWhitespace();
     bool isIdentifierChar(char c);
     bool isNumber(char c);
     void parseIndentation();
+    const Token &peekToken(size_t k = 0) { return tokens.peek(k); }
+    void syncTokens(size_t offset);
     void advance();
     bool match(TokenType type);
     void consume(TokenType type, const string &message);
-    void setError(const string &message);
+    void setError(const string &message, size_t offset);
+    void clearError();
 
     // Symbol table methods
-    void addSymbol(const string& name, const string& type, const string& dataType);
-    void addToken(const string& lexeme, const string& tokenType);
+    void addSymbol(const string& name, const string& type, const string& dataType, size_t offset);
+    void addToken(const string& lexeme, const string& tokenType, size_t offset);
+
+    // Pre-parse scanning
+    int measureIndent(size_t &pos) const;
+    size_t recordFunctionStub(size_t lineIndex, size_t defPos, int indent);
 
     // Parsing methods
+    void parseLines();
     void parseProgram();
-    void parseStatement();
+    void parseStatement(const LogicalLine &logicalLine);
     void parseExpression();
     void parseFunctionDef();
     void parseIfStatement();
@@ -89,6 +152,8 @@ private:
     void parseForStatement();
     void parseBlock();
     void parseAssignment();
+    void parseAnnotatedAssignment();
+    bool isCompoundKeyword(const Token &first, const Token &second) const;
     void parseReturnStatement();
 
     // Expression parsing
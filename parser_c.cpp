@@ -0,0 +1,110 @@
+#include "parser_c.h"
+#include "parser.h"
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+using namespace std;
+
+struct pp_parser {
+    Parser parser;
+
+    pp_parser(const string &source) : parser(source) {}
+};
+
+namespace {
+
+// Adapts the C callback table to the C++ visitor interface
+class CallbackVisitor : public ParseVisitor {
+public:
+    CallbackVisitor(const Parser &parser, const pp_callbacks &callbacks)
+        : parser(parser), callbacks(callbacks) {}
+
+    void onToken(const TokenInfo &token) override {
+        if (!callbacks.on_token) return;
+        pp_token out;
+        out.lexeme = token.lexeme.c_str();
+        out.token_type = token.tokenType.c_str();
+        out.offset = token.offset;
+        out.line = parser.lineOf(token.offset);
+        out.column = parser.columnOf(token.offset);
+        callbacks.on_token(callbacks.user_data, &out);
+    }
+
+    void onSymbol(const string &name, const SymbolInfo &symbol) override {
+        if (!callbacks.on_symbol) return;
+        pp_symbol out;
+        out.name = name.c_str();
+        out.kind = symbol.type.c_str();
+        out.data_type = symbol.dataType.c_str();
+        out.offset = symbol.offset;
+        out.line = parser.lineOf(symbol.offset);
+        out.scope = symbol.scope;
+        callbacks.on_symbol(callbacks.user_data, &out);
+    }
+
+    void onDiagnostic(const Diagnostic &diagnostic) override {
+        if (!callbacks.on_diagnostic) return;
+        pp_diagnostic out;
+        out.message = diagnostic.message.c_str();
+        out.offset = diagnostic.offset;
+        out.line = parser.lineOf(diagnostic.offset);
+        out.column = parser.columnOf(diagnostic.offset);
+        callbacks.on_diagnostic(callbacks.user_data, &out);
+    }
+
+private:
+    const Parser &parser;
+    const pp_callbacks &callbacks;
+};
+
+} // namespace
+
+extern "C" {
+
+int pp_abi_version(void) {
+    return PP_ABI_VERSION;
+}
+
+pp_parser *pp_parser_create(const char *source, size_t length) {
+    try {
+        return new pp_parser(string(source ? source : "", source ? length : 0));
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+void pp_parser_destroy(pp_parser *parser) {
+    delete parser;
+}
+
+int pp_parser_parse(pp_parser *parser, const pp_callbacks *callbacks) {
+    if (!parser) return 1;
+
+    // Fields past the caller's struct_size stay null
+    pp_callbacks table;
+    memset(&table, 0, sizeof(table));
+    if (callbacks)
+        memcpy(&table, callbacks, min(callbacks->struct_size, sizeof(table)));
+    CallbackVisitor visitor(parser->parser, table);
+    try {
+        parser->parser.setVisitor(&visitor);
+        parser->parser.setRecordTables(false);
+        parser->parser.parse();
+    } catch (...) {
+        parser->parser.setVisitor(nullptr);
+        return 1;
+    }
+    parser->parser.setVisitor(nullptr);
+    return parser->parser.hasError() ? 1 : 0;
+}
+
+const char *pp_parser_error_message(const pp_parser *parser) {
+    return parser ? parser->parser.getErrorMessage().c_str() : "";
+}
+
+size_t pp_parser_error_offset(const pp_parser *parser) {
+    return parser ? parser->parser.getErrorOffset() : 0;
+}
+
+} // extern "C"
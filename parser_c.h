@@ -0,0 +1,79 @@
+#ifndef PARSER_C_H
+#define PARSER_C_H
+
+/*
+ * C interface to the lexer and parser for FFI callers.
+ *
+ * The parser handle is opaque. Strings passed to callbacks are only valid
+ * for the duration of the call. Struct layouts below are part of the ABI and
+ * PP_ABI_VERSION is bumped when one changes. Structs passed in by the caller
+ * start with their own size, so a library built against a newer header only
+ * reads the fields the caller knows about.
+ */
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PP_ABI_VERSION 2
+
+typedef struct pp_parser pp_parser;
+
+typedef struct {
+    const char *lexeme;
+    const char *token_type;
+    size_t offset;
+    int line;
+    int column;
+} pp_token;
+
+typedef struct {
+    const char *name;
+    const char *kind;        /* "Variable", "Function", ... */
+    const char *data_type;
+    size_t offset;
+    int line;
+    int scope;
+} pp_symbol;
+
+typedef struct {
+    const char *message;
+    size_t offset;
+    int line;
+    int column;
+} pp_diagnostic;
+
+typedef struct {
+    size_t struct_size;      /* sizeof(pp_callbacks) as seen by the caller */
+    void (*on_token)(void *user_data, const pp_token *token);
+    void (*on_symbol)(void *user_data, const pp_symbol *symbol);
+    void (*on_diagnostic)(void *user_data, const pp_diagnostic *diagnostic);
+    void *user_data;
+} pp_callbacks;
+
+int pp_abi_version(void);
+
+/* Returns NULL on allocation failure. The source is copied. */
+pp_parser *pp_parser_create(const char *source, size_t length);
+void pp_parser_destroy(pp_parser *parser);
+
+/*
+ * Parses the source, streaming results through the callbacks (any of which
+ * may be NULL; callbacks itself may be NULL). Results are not retained by
+ * the parser. Each call parses the whole source again, so a handle can be
+ * parsed more than once. Returns 0 on success and 1 if a syntax error was
+ * found.
+ */
+int pp_parser_parse(pp_parser *parser, const pp_callbacks *callbacks);
+
+/* Last error message, or an empty string when there is none. */
+const char *pp_parser_error_message(const pp_parser *parser);
+size_t pp_parser_error_offset(const pp_parser *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* PARSER_C_H */
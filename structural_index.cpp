@@ -0,0 +1,263 @@
+#include "structural_index.h"
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__PCLMUL__)
+#include <wmmintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+const size_t BLOCK_SIZE = 64;
+
+// Per-block character classes, one bit per byte
+struct BlockMasks {
+    uint64_t doubleQuote;
+    uint64_t singleQuote;
+    uint64_t hash;
+    uint64_t newline;
+    uint64_t backslash;
+    uint64_t open;
+    uint64_t close;
+};
+
+#if defined(__SSE2__)
+inline uint64_t matchByte(const __m128i chunks[4], char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    uint64_t m0 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[0], needle)));
+    uint64_t m1 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[1], needle)));
+    uint64_t m2 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[2], needle)));
+    uint64_t m3 = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[3], needle)));
+    return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+}
+
+void classify(const char* block, BlockMasks& masks) {
+    __m128i chunks[4];
+    for (int i = 0; i < 4; i++) {
+        chunks[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16 * i));
+    }
+    masks.doubleQuote = matchByte(chunks, '"');
+    masks.singleQuote = matchByte(chunks, '\'');
+    masks.hash = matchByte(chunks, '#');
+    masks.newline = matchByte(chunks, '\n');
+    masks.backslash = matchByte(chunks, '\\');
+    masks.open = matchByte(chunks, '(') | matchByte(chunks, '[') | matchByte(chunks, '{');
+    masks.close = matchByte(chunks, ')') | matchByte(chunks, ']') | matchByte(chunks, '}');
+}
+#else
+void classify(const char* block, BlockMasks& masks) {
+    memset(&masks, 0, sizeof(masks));
+    for (size_t i = 0; i < BLOCK_SIZE; i++) {
+        uint64_t bit = uint64_t(1) << i;
+        switch (block[i]) {
+            case '"': masks.doubleQuote |= bit; break;
+            case '\'': masks.singleQuote |= bit; break;
+            case '#': masks.hash |= bit; break;
+            case '\n': masks.newline |= bit; break;
+            case '\\': masks.backslash |= bit; break;
+            case '(': case '[': case '{': masks.open |= bit; break;
+            case ')': case ']': case '}': masks.close |= bit; break;
+        }
+    }
+}
+#endif
+
+// Bit i of the result is the XOR of bits 0..i of the input
+inline uint64_t prefixXor(uint64_t bits) {
+#if defined(__PCLMUL__)
+    __m128i product = _mm_clmulepi64_si128(
+        _mm_set_epi64x(0, static_cast<long long>(bits)), _mm_set1_epi8('\xFF'), 0);
+    return static_cast<uint64_t>(_mm_cvtsi128_si64(product));
+#else
+    bits ^= bits << 1;
+    bits ^= bits << 2;
+    bits ^= bits << 4;
+    bits ^= bits << 8;
+    bits ^= bits << 16;
+    bits ^= bits << 32;
+    return bits;
+#endif
+}
+
+inline int lowestBit(uint64_t bits) {
+    return __builtin_ctzll(bits);
+}
+
+// Bits [from, to] of a block, clipped to the block
+inline uint64_t rangeMask(size_t from, size_t to) {
+    uint64_t upper = to >= BLOCK_SIZE - 1 ? ~uint64_t(0) : (uint64_t(1) << (to + 1)) - 1;
+    uint64_t lower = (uint64_t(1) << from) - 1;
+    return upper & ~lower;
+}
+
+enum class ScanState { NORMAL, COMMENT, STRING };
+
+} // namespace
+
+StructuralIndex::StructuralIndex(const string& source) {
+    buildStructurals(source);
+    buildLogicalLines(source);
+}
+
+void StructuralIndex::buildStructurals(const string& source) {
+    const char* data = source.data();
+    const size_t length = source.length();
+    structurals.reserve(length / 8 + 1);
+
+    ScanState state = ScanState::NORMAL;
+    char quote = 0;
+    bool triple = false;
+    size_t skipUntil = 0;      // Positions consumed as part of a quote or escape
+    size_t suppressUntil = 0;  // Newlines escaped by a backslash outside strings
+
+    char padded[BLOCK_SIZE];
+    for (size_t blockStart = 0; blockStart < length; blockStart += BLOCK_SIZE) {
+        const char* block = data + blockStart;
+        size_t blockLength = min(BLOCK_SIZE, length - blockStart);
+        if (blockLength < BLOCK_SIZE) {
+            memset(padded, ' ', BLOCK_SIZE);
+            memcpy(padded, block, blockLength);
+            block = padded;
+        }
+
+        BlockMasks masks;
+        classify(block, masks);
+
+        uint64_t inside = 0;        // String and comment interiors
+        uint64_t commentStart = 0;  // '#' characters that open a comment
+        uint64_t suppressed = 0;
+
+        // Fast path: only plain double-quoted strings in the block. Quotes
+        // pair up, so the string interiors are the prefix-XOR of the quote
+        // bits. Adjacent quotes could form """ and are left to the slow path.
+        bool fast = (state == ScanState::NORMAL ||
+                     (state == ScanState::STRING && quote == '"' && !triple)) &&
+                    skipUntil <= blockStart && suppressUntil <= blockStart &&
+                    (masks.singleQuote | masks.hash | masks.backslash) == 0 &&
+                    (masks.doubleQuote & (masks.doubleQuote >> 1)) == 0 &&
+                    (masks.doubleQuote >> 63) == 0;
+        if (fast) {
+            inside = prefixXor(masks.doubleQuote);
+            if (state == ScanState::STRING) inside = ~inside;
+            // A single-quoted string cannot run past a newline; let the
+            // slow path end it there
+            fast = (inside & masks.newline) == 0;
+        }
+
+        if (fast) {
+            if (inside >> 63) {
+                state = ScanState::STRING;
+                quote = '"';
+                triple = false;
+            } else {
+                state = ScanState::NORMAL;
+            }
+        } else {
+            inside = 0;
+            size_t regionStart = blockStart;
+            if (suppressUntil > blockStart) {
+                suppressed |= rangeMask(0, suppressUntil - blockStart - 1);
+            }
+
+            // Walk only the bytes that can change the scan state
+            uint64_t candidates = masks.doubleQuote | masks.singleQuote | masks.hash |
+                                  masks.newline | masks.backslash;
+            while (candidates) {
+                size_t bit = lowestBit(candidates);
+                candidates &= candidates - 1;
+                size_t pos = blockStart + bit;
+                if (pos < skipUntil) continue;
+                char c = data[pos];
+
+                if (state == ScanState::NORMAL) {
+                    if (c == '#') {
+                        state = ScanState::COMMENT;
+                        regionStart = pos;
+                        commentStart |= uint64_t(1) << bit;
+                    } else if (c == '"' || c == '\'') {
+                        state = ScanState::STRING;
+                        quote = c;
+                        triple = pos + 2 < length && data[pos + 1] == c && data[pos + 2] == c;
+                        regionStart = pos;
+                        skipUntil = pos + (triple ? 3 : 1);
+                    } else if (c == '\\') {
+                        // Explicit line continuation, possibly before "\r\n"
+                        size_t escaped = pos + 1 < length && data[pos + 1] == '\r' ? 2 : 1;
+                        skipUntil = suppressUntil = pos + 1 + escaped;
+                        if (bit + escaped < BLOCK_SIZE) suppressed |= uint64_t(1) << (bit + escaped);
+                    }
+                } else if (state == ScanState::COMMENT) {
+                    if (c == '\n') {
+                        if (bit > regionStart - blockStart) {
+                            inside |= rangeMask(regionStart - blockStart, bit - 1);
+                        }
+                        state = ScanState::NORMAL;
+                    }
+                } else {
+                    if (c == '\\') {
+                        skipUntil = pos + 2;
+                    } else if (c == quote) {
+                        if (!triple) {
+                            inside |= rangeMask(regionStart - blockStart, bit);
+                            state = ScanState::NORMAL;
+                        } else if (pos + 2 < length && data[pos + 1] == quote && data[pos + 2] == quote) {
+                            inside |= rangeMask(regionStart - blockStart, min(bit + 2, BLOCK_SIZE - 1));
+                            skipUntil = pos + 3;
+                            state = ScanState::NORMAL;
+                        }
+                    } else if (c == '\n' && !triple) {
+                        // Unterminated string; the newline still ends the line
+                        if (bit > regionStart - blockStart) {
+                            inside |= rangeMask(regionStart - blockStart, bit - 1);
+                        }
+                        state = ScanState::NORMAL;
+                    }
+                }
+            }
+            if (state != ScanState::NORMAL) {
+                inside |= rangeMask(regionStart - blockStart, BLOCK_SIZE - 1);
+            }
+        }
+
+        // Stage two: flatten the surviving bits into offsets
+        uint64_t bits = ((masks.open | masks.close | masks.newline) & ~inside & ~suppressed) |
+                        commentStart;
+        if (blockLength < BLOCK_SIZE) bits &= (uint64_t(1) << blockLength) - 1;
+        while (bits) {
+            structurals.push_back(blockStart + lowestBit(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+void StructuralIndex::buildLogicalLines(const string& source) {
+    int depth = 0;
+    size_t lineBegin = 0;
+    size_t lineFirst = 0;
+    for (size_t i = 0; i < structurals.size(); i++) {
+        char c = source[structurals[i]];
+        if (c == '(' || c == '[' || c == '{') {
+            depth++;
+        } else if (c == ')' || c == ']' || c == '}') {
+            if (depth > 0) depth--;
+        } else if (c == '\n' && depth == 0) {
+            logicalLines.push_back({lineBegin, structurals[i], lineFirst, i - lineFirst});
+            lineBegin = structurals[i] + 1;
+            lineFirst = i + 1;
+        }
+    }
+    if (lineBegin < source.length()) {
+        logicalLines.push_back({lineBegin, source.length(), lineFirst, structurals.size() - lineFirst});
+    }
+}
+
+size_t StructuralIndex::lineAt(size_t offset) const {
+    auto it = upper_bound(logicalLines.begin(), logicalLines.end(), offset,
+        [](size_t value, const LogicalLine& line) { return value < line.begin; });
+    return it == logicalLines.begin() ? 0 : static_cast<size_t>(it - logicalLines.begin()) - 1;
+}
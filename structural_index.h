@@ -0,0 +1,48 @@
+#ifndef STRUCTURAL_INDEX_H
+#define STRUCTURAL_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+using namespace std;
+
+// A logical line: one statement's worth of source, which may span several
+// physical lines when brackets are open or a line ends in a backslash.
+struct LogicalLine {
+    size_t begin;            // First byte of the first physical line
+    size_t end;              // Terminating newline, or end of input
+    size_t firstStructural;  // Index of the first structural in the line
+    size_t structuralCount;  // Structurals in [begin, end)
+};
+
+// Index of the structural characters of a Python source: brackets, comment
+// starts and newlines that are not inside a string literal or a comment.
+//
+// Built in two stages. Stage one classifies the input 64 bytes at a time
+// into bitmasks (quotes, '#', newlines, brackets, backslashes) and masks out
+// string and comment interiors; blocks with only plain double-quoted strings
+// are resolved with a prefix-XOR, anything else walks just the candidate
+// bits of the block. Stage two turns the remaining bits into offsets and
+// splits them into logical lines.
+class StructuralIndex {
+public:
+    StructuralIndex(const string& source);
+
+    // Byte offsets, like the parser's, so sources of any size index correctly
+    const vector<size_t>& getStructurals() const { return structurals; }
+    const vector<LogicalLine>& getLogicalLines() const { return logicalLines; }
+
+    // Index of the logical line containing offset
+    size_t lineAt(size_t offset) const;
+
+private:
+    vector<size_t> structurals;
+    vector<LogicalLine> logicalLines;
+
+    void buildStructurals(const string& source);
+    void buildLogicalLines(const string& source);
+};
+
+#endif // STRUCTURAL_INDEX_H
@@ -0,0 +1,562 @@
+#include "symbol_index.h"
+#include "parser.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+#include <climits>
+#include <cstdlib>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace std;
+
+static const char INDEX_MAGIC[8] = {'P', 'Y', 'S', 'Y', 'M', 'I', 'D', 'X'};
+static const uint32_t INDEX_VERSION = 2;  // 2: nanosecond mtimes
+
+static uint64_t hashContent(const string &content) {
+    uint64_t hash = 1469598103934665603ULL;  // FNV-1a offset basis
+    for (unsigned char c : content) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static bool readFile(const string &path, string &content) {
+    ifstream in(path, ios::binary);
+    if (!in) return false;
+    in.seekg(0, ios::end);
+    content.resize(static_cast<size_t>(in.tellg()));
+    in.seekg(0, ios::beg);
+    in.read(&content[0], content.size());
+    return static_cast<bool>(in);
+}
+
+struct SourceFile {
+    string relativePath;
+    int64_t mtime;  // Nanoseconds since the epoch
+    uint64_t size;
+};
+
+static int64_t modificationTime(const struct stat &info) {
+#if defined(__linux__)
+    return static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+    return static_cast<int64_t>(info.st_mtimespec.tv_sec) * 1000000000 + info.st_mtimespec.tv_nsec;
+#else
+    return static_cast<int64_t>(info.st_mtime) * 1000000000;
+#endif
+}
+
+// Collects every .py file below root, skipping hidden and symlinked directories
+static void collectSources(const string &root, const string &relative,
+                           vector<SourceFile> &out, vector<string> *directories) {
+    string dirPath = relative.empty() ? root : root + "/" + relative;
+    DIR *dir = opendir(dirPath.c_str());
+    if (!dir) return;
+    if (directories) directories->push_back(dirPath);
+
+    while (dirent *entry = readdir(dir)) {
+        string name = entry->d_name;
+        if (name.empty() || name[0] == '.') continue;
+
+        string childRelative = relative.empty() ? name : relative + "/" + name;
+        string childPath = root + "/" + childRelative;
+        struct stat info;
+#ifndef _WIN32
+        // Symlinked directories are not followed, so a link back to an
+        // ancestor cannot make the walk recurse; symlinked files are indexed
+        if (lstat(childPath.c_str(), &info) != 0) continue;
+        if (S_ISLNK(info.st_mode) &&
+            (stat(childPath.c_str(), &info) != 0 || S_ISDIR(info.st_mode))) {
+            continue;
+        }
+#else
+        if (stat(childPath.c_str(), &info) != 0) continue;
+#endif
+
+        if (S_ISDIR(info.st_mode)) {
+            collectSources(root, childRelative, out, directories);
+        } else if (S_ISREG(info.st_mode) && name.size() > 3 &&
+                   name.compare(name.size() - 3, 3, ".py") == 0) {
+            out.push_back({childRelative, modificationTime(info),
+                           static_cast<uint64_t>(info.st_size)});
+        }
+    }
+    closedir(dir);
+}
+
+#ifdef __linux__
+// Canonical form of an existing path, or the path itself if it cannot be resolved
+static string resolvePath(const string &path) {
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) ? string(resolved) : path;
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// SymbolIndex
+
+SymbolIndex::SymbolIndex()
+    : data(nullptr), dataSize(0), header(nullptr), files(nullptr),
+      symbols(nullptr), strings(nullptr), errorOccurred(false) {}
+
+SymbolIndex::~SymbolIndex() {
+    close();
+}
+
+bool SymbolIndex::setError(const string &message) {
+    errorOccurred = true;
+    errorMessage = message;
+    close();
+    return false;
+}
+
+bool SymbolIndex::open(const string &path) {
+    close();
+    errorOccurred = false;
+    errorMessage.clear();
+
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return setError("Cannot open index " + path);
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        ::close(fd);
+        return setError("Cannot read index " + path);
+    }
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return setError("Cannot map index " + path);
+    data = static_cast<const char *>(mapped);
+    dataSize = info.st_size;
+#else
+    string content;
+    if (!readFile(path, content)) return setError("Cannot open index " + path);
+    fallbackBuffer.assign(content.begin(), content.end());
+    data = fallbackBuffer.data();
+    dataSize = fallbackBuffer.size();
+#endif
+
+    if (dataSize < sizeof(IndexHeader)) return setError("Truncated index " + path);
+    header = reinterpret_cast<const IndexHeader *>(data);
+    if (memcmp(header->magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 ||
+        header->version != INDEX_VERSION) {
+        return setError("Unsupported index format in " + path);
+    }
+    if (header->filesOffset > dataSize || header->symbolsOffset > dataSize ||
+        header->stringsOffset > dataSize ||
+        header->filesOffset + uint64_t(header->fileCount) * sizeof(IndexFileRecord) > dataSize ||
+        header->symbolsOffset + uint64_t(header->symbolCount) * sizeof(IndexSymbolRecord) > dataSize ||
+        header->stringsSize > dataSize - header->stringsOffset) {
+        return setError("Corrupt index " + path);
+    }
+
+    files = reinterpret_cast<const IndexFileRecord *>(data + header->filesOffset);
+    symbols = reinterpret_cast<const IndexSymbolRecord *>(data + header->symbolsOffset);
+    strings = data + header->stringsOffset;
+    if (!recordsValid()) return setError("Corrupt index " + path);
+    return true;
+}
+
+bool SymbolIndex::recordsValid() const {
+    // Lookups compare names straight out of the string pool, so every
+    // record is checked once here rather than on each probe
+    auto inPool = [this](uint32_t offset, uint32_t length) {
+        return uint64_t(offset) + length <= header->stringsSize;
+    };
+    for (uint32_t i = 0; i < header->fileCount; i++) {
+        if (!inPool(files[i].pathOffset, files[i].pathLength)) return false;
+    }
+    for (uint32_t i = 0; i < header->symbolCount; i++) {
+        const IndexSymbolRecord &record = symbols[i];
+        if (!inPool(record.nameOffset, record.nameLength) ||
+            !inPool(record.kindOffset, record.kindLength) ||
+            record.fileIndex >= header->fileCount) {
+            return false;
+        }
+        if (i > 0) {
+            const IndexSymbolRecord &previous = symbols[i - 1];
+            int result = memcmp(strings + previous.nameOffset, strings + record.nameOffset,
+                                min(previous.nameLength, record.nameLength));
+            if (result > 0 || (result == 0 && previous.nameLength > record.nameLength)) return false;
+        }
+    }
+    return true;
+}
+
+void SymbolIndex::close() {
+#ifndef _WIN32
+    if (data) munmap(const_cast<char *>(data), dataSize);
+#endif
+    fallbackBuffer.clear();
+    data = nullptr;
+    dataSize = 0;
+    header = nullptr;
+    files = nullptr;
+    symbols = nullptr;
+    strings = nullptr;
+}
+
+string SymbolIndex::stringAt(uint32_t offset, uint32_t length) const {
+    if (!header || uint64_t(offset) + length > header->stringsSize) return string();
+    return string(strings + offset, length);
+}
+
+int SymbolIndex::compareName(const IndexSymbolRecord &record, const string &key, bool prefixOnly) const {
+    size_t length = prefixOnly ? min<size_t>(record.nameLength, key.size()) : record.nameLength;
+    int result = memcmp(strings + record.nameOffset, key.data(), min(length, key.size()));
+    if (result != 0) return result;
+    if (length < key.size()) return -1;
+    return length > key.size() ? 1 : 0;
+}
+
+IndexedSymbol SymbolIndex::materialize(const IndexSymbolRecord &record) const {
+    IndexedSymbol symbol;
+    symbol.name = stringAt(record.nameOffset, record.nameLength);
+    symbol.kind = stringAt(record.kindOffset, record.kindLength);
+    if (record.fileIndex < header->fileCount) {
+        const IndexFileRecord &file = files[record.fileIndex];
+        symbol.file = stringAt(file.pathOffset, file.pathLength);
+    }
+    symbol.line = static_cast<int>(record.line);
+    symbol.scope = record.scope;
+    return symbol;
+}
+
+vector<IndexedSymbol> SymbolIndex::findExact(const string &name) const {
+    vector<IndexedSymbol> results;
+    if (!header) return results;
+
+    const IndexSymbolRecord *end = symbols + header->symbolCount;
+    const IndexSymbolRecord *it = lower_bound(symbols, end, name,
+        [this](const IndexSymbolRecord &record, const string &key) {
+            return compareName(record, key, false) < 0;
+        });
+    for (; it != end && compareName(*it, name, false) == 0; ++it) {
+        results.push_back(materialize(*it));
+    }
+    return results;
+}
+
+vector<IndexedSymbol> SymbolIndex::findPrefix(const string &prefix, size_t limit) const {
+    vector<IndexedSymbol> results;
+    if (!header) return results;
+
+    const IndexSymbolRecord *end = symbols + header->symbolCount;
+    const IndexSymbolRecord *it = lower_bound(symbols, end, prefix,
+        [this](const IndexSymbolRecord &record, const string &key) {
+            return compareName(record, key, true) < 0;
+        });
+    for (; it != end && results.size() < limit && compareName(*it, prefix, true) == 0; ++it) {
+        results.push_back(materialize(*it));
+    }
+    return results;
+}
+
+// ---------------------------------------------------------------------------
+// SymbolIndexBuilder
+
+namespace {
+
+struct PendingSymbol {
+    string name;
+    string kind;
+    uint32_t line;
+    int32_t scope;
+};
+
+struct PendingFile {
+    SourceFile source;
+    uint64_t contentHash;
+    vector<PendingSymbol> symbols;
+};
+
+// Deduplicating string pool for the index being written
+class StringPool {
+public:
+    uint32_t add(const string &value) {
+        auto it = offsets.find(value);
+        if (it != offsets.end()) return it->second;
+        uint32_t offset = static_cast<uint32_t>(bytes.size());
+        bytes.insert(bytes.end(), value.begin(), value.end());
+        offsets.emplace(value, offset);
+        return offset;
+    }
+    const vector<char> &data() const { return bytes; }
+
+private:
+    vector<char> bytes;
+    unordered_map<string, uint32_t> offsets;
+};
+
+} // namespace
+
+bool SymbolIndexBuilder::setError(const string &message) {
+    errorOccurred = true;
+    errorMessage = message;
+    return false;
+}
+
+bool SymbolIndexBuilder::update(const string &root, const string &indexPath) {
+    errorOccurred = false;
+    errorMessage.clear();
+    stats = {0, 0, 0, 0};
+
+    // Entries from the previous index, keyed by relative path
+    map<string, PendingFile> previous;
+    int64_t indexWritten = 0;
+    {
+        struct stat info;
+        if (stat(indexPath.c_str(), &info) == 0) indexWritten = modificationTime(info);
+        SymbolIndex old;
+        if (old.open(indexPath)) {
+            vector<PendingFile *> byIndex(old.fileCount());
+            for (size_t i = 0; i < old.fileCount(); i++) {
+                const IndexFileRecord &record = old.fileRecord(i);
+                PendingFile &file = previous[old.stringAt(record.pathOffset, record.pathLength)];
+                file.source.mtime = record.mtime;
+                file.source.size = record.size;
+                file.contentHash = record.contentHash;
+                byIndex[i] = &file;
+            }
+            for (size_t i = 0; i < old.symbolCount(); i++) {
+                const IndexSymbolRecord &record = old.symbolRecord(i);
+                if (record.fileIndex >= byIndex.size()) continue;
+                byIndex[record.fileIndex]->symbols.push_back(
+                    {old.stringAt(record.nameOffset, record.nameLength),
+                     old.stringAt(record.kindOffset, record.kindLength),
+                     record.line, record.scope});
+            }
+        }
+    }
+
+    vector<SourceFile> sources;
+    collectSources(root, "", sources, nullptr);
+    sort(sources.begin(), sources.end(),
+         [](const SourceFile &a, const SourceFile &b) { return a.relativePath < b.relativePath; });
+
+    vector<PendingFile> current;
+    current.reserve(sources.size());
+    for (const SourceFile &source : sources) {
+        auto old = previous.find(source.relativePath);
+        // A file modified in the same clock tick the old index was written
+        // may have changed again without its mtime moving, so only files
+        // strictly older than the index are trusted without re-hashing
+        if (old != previous.end() && old->second.source.mtime == source.mtime &&
+            old->second.source.size == source.size && source.mtime < indexWritten) {
+            old->second.source = source;
+            current.push_back(move(old->second));
+            stats.reused++;
+            continue;
+        }
+
+        string content;
+        if (!readFile(root + "/" + source.relativePath, content)) continue;
+        uint64_t hash = hashContent(content);
+        if (old != previous.end() && old->second.contentHash == hash) {
+            // Touched but not modified
+            old->second.source = source;
+            current.push_back(move(old->second));
+            stats.reused++;
+            continue;
+        }
+
+        PendingFile file;
+        file.source = source;
+        file.contentHash = hash;
+        Parser parser(content);
+        parser.parse();
+        for (const auto &entry : parser.getSymbolTable()) {
+            file.symbols.push_back({entry.first, entry.second.type,
+                                    static_cast<uint32_t>(parser.lineOf(entry.second.offset)),
+                                    entry.second.scope});
+        }
+        current.push_back(move(file));
+        stats.reparsed++;
+    }
+
+    // Lay out the new index
+    StringPool pool;
+    vector<IndexFileRecord> fileRecords;
+    vector<IndexSymbolRecord> symbolRecords;
+    for (size_t i = 0; i < current.size(); i++) {
+        const PendingFile &file = current[i];
+        IndexFileRecord record;
+        record.pathOffset = pool.add(file.source.relativePath);
+        record.pathLength = static_cast<uint32_t>(file.source.relativePath.size());
+        record.mtime = file.source.mtime;
+        record.size = file.source.size;
+        record.contentHash = file.contentHash;
+        fileRecords.push_back(record);
+
+        for (const PendingSymbol &symbol : file.symbols) {
+            IndexSymbolRecord entry;
+            entry.nameOffset = pool.add(symbol.name);
+            entry.nameLength = static_cast<uint32_t>(symbol.name.size());
+            entry.kindOffset = pool.add(symbol.kind);
+            entry.kindLength = static_cast<uint32_t>(symbol.kind.size());
+            entry.fileIndex = static_cast<uint32_t>(i);
+            entry.line = symbol.line;
+            entry.scope = symbol.scope;
+            symbolRecords.push_back(entry);
+        }
+    }
+
+    const vector<char> &poolData = pool.data();
+    sort(symbolRecords.begin(), symbolRecords.end(),
+         [&poolData](const IndexSymbolRecord &a, const IndexSymbolRecord &b) {
+             int result = memcmp(poolData.data() + a.nameOffset, poolData.data() + b.nameOffset,
+                                 min(a.nameLength, b.nameLength));
+             if (result != 0) return result < 0;
+             if (a.nameLength != b.nameLength) return a.nameLength < b.nameLength;
+             if (a.fileIndex != b.fileIndex) return a.fileIndex < b.fileIndex;
+             return a.line < b.line;
+         });
+
+    IndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.fileCount = static_cast<uint32_t>(fileRecords.size());
+    header.symbolCount = static_cast<uint32_t>(symbolRecords.size());
+    header.filesOffset = sizeof(IndexHeader);
+    header.symbolsOffset = header.filesOffset + fileRecords.size() * sizeof(IndexFileRecord);
+    header.stringsOffset = header.symbolsOffset + symbolRecords.size() * sizeof(IndexSymbolRecord);
+    header.stringsSize = poolData.size();
+
+    // Write beside the old index and swap it in, so readers holding a
+    // mapping of the previous version are unaffected.
+    string tempPath = indexPath + ".tmp";
+    {
+        ofstream out(tempPath, ios::binary | ios::trunc);
+        if (!out) return setError("Cannot write index " + tempPath);
+        out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char *>(fileRecords.data()),
+                  fileRecords.size() * sizeof(IndexFileRecord));
+        out.write(reinterpret_cast<const char *>(symbolRecords.data()),
+                  symbolRecords.size() * sizeof(IndexSymbolRecord));
+        out.write(poolData.data(), poolData.size());
+        if (!out) return setError("Cannot write index " + tempPath);
+    }
+#ifdef _WIN32
+    remove(indexPath.c_str());
+#endif
+    if (rename(tempPath.c_str(), indexPath.c_str()) != 0) {
+        return setError("Cannot replace index " + indexPath);
+    }
+
+    stats.files = fileRecords.size();
+    stats.symbols = symbolRecords.size();
+    return true;
+}
+
+bool SymbolIndexBuilder::watch(const string &root, const string &indexPath,
+                               const function<void(const Stats &)> &onUpdate) {
+#ifdef __linux__
+    if (!update(root, indexPath)) return false;
+    onUpdate(stats);
+
+    int fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) return setError("Cannot initialize inotify");
+
+    // An index written inside root must not trigger updates of its own,
+    // so events are matched against its resolved directory and name
+    size_t slash = indexPath.find_last_of('/');
+    string indexName = slash == string::npos ? indexPath : indexPath.substr(slash + 1);
+    string indexDir = resolvePath(slash == string::npos ? "." : slash == 0 ? "/" : indexPath.substr(0, slash));
+
+    const uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                          IN_MOVED_TO | IN_DELETE_SELF;
+    map<int, string> watched;  // Watch descriptor -> resolved directory
+    auto addWatches = [&]() {
+        vector<SourceFile> ignored;
+        vector<string> directories;
+        collectSources(root, "", ignored, &directories);
+        // Re-adding an existing watch is a no-op, so new directories are
+        // picked up by simply walking the tree again.
+        for (const string &dir : directories) {
+            int wd = inotify_add_watch(fd, dir.c_str(), mask);
+            if (wd >= 0 && watched.find(wd) == watched.end()) watched[wd] = resolvePath(dir);
+        }
+    };
+    addWatches();
+
+    // True if the events touch a .py file or add, remove or move a directory
+    auto affectsSources = [&](const char *events, ssize_t length) {
+        bool affected = false;
+        for (ssize_t pos = 0; pos < length;) {
+            const inotify_event *event = reinterpret_cast<const inotify_event *>(events + pos);
+            pos += sizeof(inotify_event) + event->len;
+            if (event->mask & IN_IGNORED) {
+                watched.erase(event->wd);
+                continue;
+            }
+            if (event->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF)) {
+                affected = true;
+                continue;
+            }
+            if (event->len == 0) continue;
+
+            string name = event->name;
+            if (name.empty() || name[0] == '.') continue;  // Hidden entries are not indexed
+            auto dir = watched.find(event->wd);
+            if (dir != watched.end() && dir->second == indexDir &&
+                (name == indexName || name == indexName + ".tmp")) {
+                continue;
+            }
+            if ((event->mask & IN_ISDIR) ||
+                (name.size() > 3 && name.compare(name.size() - 3, 3, ".py") == 0)) {
+                affected = true;
+            }
+        }
+        return affected;
+    };
+
+    alignas(inotify_event) char buffer[16 * 1024];
+    while (true) {
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+            ::close(fd);
+            return setError("Error reading inotify events");
+        }
+        bool changed = affectsSources(buffer, length);
+
+        // Coalesce bursts (editors, checkouts) into a single update
+        pollfd pending = {fd, POLLIN, 0};
+        while (poll(&pending, 1, 100) > 0) {
+            length = read(fd, buffer, sizeof(buffer));
+            if (length <= 0) break;
+            if (affectsSources(buffer, length)) changed = true;
+        }
+        if (!changed) continue;
+
+        addWatches();
+        if (!update(root, indexPath)) {
+            ::close(fd);
+            return false;
+        }
+        onUpdate(stats);
+    }
+#else
+    (void)root;
+    (void)indexPath;
+    (void)onUpdate;
+    return setError("Watch mode requires inotify (Linux)");
+#endif
+}
@@ -0,0 +1,123 @@
+#ifndef SYMBOL_INDEX_H
+#define SYMBOL_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+using namespace std;
+
+// On-disk layout of a project symbol index. All integers are native-endian;
+// strings live in one pool addressed by (offset, length). Symbol records are
+// sorted by name so exact and prefix lookups are binary searches over the
+// mapped file.
+struct IndexHeader {
+    char magic[8];          // "PYSYMIDX"
+    uint32_t version;
+    uint32_t fileCount;
+    uint32_t symbolCount;
+    uint32_t reserved;
+    uint64_t filesOffset;
+    uint64_t symbolsOffset;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+struct IndexFileRecord {
+    uint32_t pathOffset;
+    uint32_t pathLength;
+    int64_t mtime;          // Nanoseconds since the epoch
+    uint64_t size;
+    uint64_t contentHash;   // FNV-1a over the file contents
+};
+
+struct IndexSymbolRecord {
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t kindOffset;
+    uint32_t kindLength;
+    uint32_t fileIndex;
+    uint32_t line;
+    int32_t scope;
+};
+
+struct IndexedSymbol {
+    string name;
+    string kind;      // Variable, Function, etc.
+    string file;      // Path relative to the indexed root
+    int line;
+    int scope;
+};
+
+// Read-only view of an index file. The file is memory-mapped, so opening
+// is O(1) and queries touch only the pages they search.
+class SymbolIndex {
+public:
+    SymbolIndex();
+    ~SymbolIndex();
+
+    bool open(const string &path);
+    void close();
+    bool hasError() const { return errorOccurred; }
+    const string &getErrorMessage() const { return errorMessage; }
+
+    vector<IndexedSymbol> findExact(const string &name) const;
+    vector<IndexedSymbol> findPrefix(const string &prefix, size_t limit = 100) const;
+
+    size_t fileCount() const { return header ? header->fileCount : 0; }
+    size_t symbolCount() const { return header ? header->symbolCount : 0; }
+    const IndexFileRecord &fileRecord(size_t index) const { return files[index]; }
+    const IndexSymbolRecord &symbolRecord(size_t index) const { return symbols[index]; }
+    string stringAt(uint32_t offset, uint32_t length) const;
+
+private:
+    const char *data;
+    size_t dataSize;
+    vector<char> fallbackBuffer;  // Used where mmap is unavailable
+    const IndexHeader *header;
+    const IndexFileRecord *files;
+    const IndexSymbolRecord *symbols;
+    const char *strings;
+    bool errorOccurred;
+    string errorMessage;
+
+    bool setError(const string &message);
+    bool recordsValid() const;
+    int compareName(const IndexSymbolRecord &record, const string &key, bool prefixOnly) const;
+    IndexedSymbol materialize(const IndexSymbolRecord &record) const;
+};
+
+// Builds and incrementally refreshes an index for every .py file under a
+// root directory. Files whose size and mtime are unchanged, and which are
+// older than the previous index, keep their old entries without being read;
+// other files are re-hashed and only re-parsed when the content hash differs.
+class SymbolIndexBuilder {
+public:
+    struct Stats {
+        size_t files;
+        size_t reparsed;
+        size_t reused;
+        size_t symbols;
+    };
+
+    SymbolIndexBuilder() : stats{0, 0, 0, 0}, errorOccurred(false) {}
+
+    bool update(const string &root, const string &indexPath);
+    // Runs update() whenever files under root change; returns only on error.
+    bool watch(const string &root, const string &indexPath,
+               const function<void(const Stats &)> &onUpdate);
+
+    const Stats &getStats() const { return stats; }
+    bool hasError() const { return errorOccurred; }
+    const string &getErrorMessage() const { return errorMessage; }
+
+private:
+    Stats stats;
+    bool errorOccurred;
+    string errorMessage;
+
+    bool setError(const string &message);
+};
+
+#endif // SYMBOL_INDEX_H
@@ -2,6 +2,7 @@
 #define TOKEN_H
 
 #include <string>
+#include <cstddef>
 
 using namespace std;
 
@@ -56,14 +57,16 @@ enum class TokenType {
     ERROR           // Invalid token
 };
 
+// Tokens record only their byte span in the source; line and column are
+// recovered on demand through a LineIndex.
 struct Token {
     TokenType type;
     string value;
-    int line;
-    int column;
+    size_t offset;  // Byte offset of the first character
+    size_t length;  // Length of the lexeme in the source
     
-    Token(TokenType t, const string& v, int l, int c)
-        : type(t), value(v), line(l), column(c) {}
+    Token(TokenType t, const string& v, size_t o, size_t len)
+        : type(t), value(v), offset(o), length(len) {}
 };
 
 #endif // TOKEN_H 
\ No newline at end of file
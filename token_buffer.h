@@ -0,0 +1,76 @@
+#ifndef TOKEN_BUFFER_H
+#define TOKEN_BUFFER_H
+
+#include <cassert>
+#include <vector>
+#include "lexer.h"
+
+using namespace std;
+
+// Ring buffer between the Lexer and its consumer. The lexer fills it a
+// batch at a time so its loop stays hot, and the consumer can look several
+// tokens ahead by reference without copying them out.
+class TokenBuffer {
+public:
+    static const size_t BATCH_SIZE = 256;
+    static const size_t CAPACITY = 512;  // Power of two, > BATCH_SIZE
+    static const size_t MAX_LOOKAHEAD = CAPACITY - BATCH_SIZE;
+
+    TokenBuffer(Lexer& lexer)
+        : lexer(lexer),
+          slots(CAPACITY, Token(TokenType::END_OF_FILE, "", 0, 0)),
+          head(0),
+          count(0),
+          reachedEnd(false) {}
+
+    // Token k positions ahead of the current one (k < MAX_LOOKAHEAD).
+    // Past the end of input this is the END_OF_FILE token.
+    const Token& peek(size_t k = 0) {
+        // Further ahead, refill() would overwrite unread tokens
+        assert(k < MAX_LOOKAHEAD);
+        while (count <= k && !reachedEnd) refill();
+        if (k >= count) return slots[(head + count - 1) & MASK];
+        return slots[(head + k) & MASK];
+    }
+
+    void advance() {
+        if (count == 0 && !reachedEnd) refill();
+        // END_OF_FILE stays current once reached
+        if (count > 1 || (count == 1 && !reachedEnd)) {
+            head = (head + 1) & MASK;
+            count--;
+        }
+    }
+
+    // Drops buffered tokens and restarts the lexer at offset
+    void seek(size_t offset) {
+        lexer.reset(offset);
+        head = 0;
+        count = 0;
+        reachedEnd = false;
+    }
+
+private:
+    static const size_t MASK = CAPACITY - 1;
+
+    Lexer& lexer;
+    vector<Token> slots;
+    size_t head;   // Slot of the current token
+    size_t count;  // Buffered tokens, starting at head
+    bool reachedEnd;
+
+    void refill() {
+        size_t tail = (head + count) & MASK;
+        size_t wanted = BATCH_SIZE < CAPACITY - count ? BATCH_SIZE : CAPACITY - count;
+        size_t first = wanted < CAPACITY - tail ? wanted : CAPACITY - tail;
+
+        size_t produced = lexer.nextBatch(&slots[tail], first);
+        if (produced == first && first < wanted) {
+            produced += lexer.nextBatch(&slots[0], wanted - first);
+        }
+        count += produced;
+        reachedEnd = produced == 0 || slots[(head + count - 1) & MASK].type == TokenType::END_OF_FILE;
+    }
+};
+
+#endif // TOKEN_BUFFER_H